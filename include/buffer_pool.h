@@ -0,0 +1,65 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <JavaScriptCore/JSObjectRef.h>
+
+#include <cstddef>
+
+namespace NX
+{
+  /**
+   * Recycles I/O buffers. Sizes are rounded up to a power of two between 1 KiB and 8 MiB, and freed buffers are
+   * kept in a cache per thread plus a shared one, since an ArrayBuffer is usually collected on another thread
+   * than the one that read into it. Each thread keeps at most 4 MiB across all sizes and the shared cache 32 MiB;
+   * buffers beyond that, and buffers over 8 MiB, go straight back to fastMalloc.
+   */
+  class BufferPool {
+  public:
+    /**
+     * The size of the buffer allocate() hands out for 'size' bytes; callers may use all of it.
+     */
+    static std::size_t capacity(std::size_t size);
+
+    static char * allocate(std::size_t size);
+    /**
+     * 'size' is what the buffer was allocated for (or its capacity).
+     */
+    static void deallocate(void * buffer, std::size_t size);
+
+    /**
+     * Wraps the first 'length' bytes of a pooled buffer in an ArrayBuffer that returns it to the pool when collected.
+     * A short read doesn't cost a realloc: the buffer is kept as it is, unless it's mostly empty, in which case the
+     * data is copied into a smaller one so a few bytes don't pin a large buffer. The buffer is taken over either way,
+     * also when this fails and returns nullptr.
+     */
+    static JSObjectRef makeArrayBuffer(JSContextRef ctx, char * buffer, std::size_t size, std::size_t length,
+                                       JSValueRef * exception);
+
+    /**
+     * Buffers handed out from a cache, and buffers that had to be allocated.
+     */
+    static std::size_t hits();
+    static std::size_t misses();
+  };
+}
+
+#endif // BUFFER_POOL_H
@@ -23,9 +23,10 @@
 #include <JavaScript.h>
 #include <string>
 #include <atomic>
-#include <unordered_map>
+#include <cstdint>
+#include <vector>
 #include <boost/noncopyable.hpp>
-#include <boost/thread/shared_mutex.hpp>
+#include <mutex>
 #include <utility>
 
 #include "object.h"
@@ -56,9 +57,25 @@ namespace NX
       }
 
     public:
-      Emitter(): myMap(), myTidyLock() {}
+      Emitter(): myTable(nullptr), myEpoch(0), myReaders(), myWriteLock() {}
 
-      ~Emitter() override = default;
+      ~Emitter() override;
+
+      typedef std::uint32_t EventId;
+
+      // what find() returns for a name nothing ever listened to; no listener has it
+      static constexpr EventId NoEvent = ~EventId(0);
+
+      /**
+       * Maps an event name to its id. Ids are process-wide and never released, so only adding a listener interns
+       * a name; code that emits the same event over and over looks its id up once and keeps it.
+       */
+      static EventId intern(const std::string & name);
+      /**
+       * The id of a name that was interned already, or NoEvent. Emitting and removing listeners by name go through
+       * this, so names made up on the fly don't pile up in the table.
+       */
+      static EventId find(const std::string & name);
 
       typedef std::function<JSValueRef(JSContextRef, std::size_t argumentCount, const JSValueRef arguments[], JSValueRef *)> EventCallback;
 
@@ -68,6 +85,7 @@ namespace NX
       virtual JSValueRef addOnceListener(JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, EventCallback callback) {
         return addManyListener(ctx, thisObject, e, std::move(callback), 1);
       }
+      /* Native listeners are called straight from emitFast(), without going through JavaScript */
       virtual JSValueRef addManyListener( JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, EventCallback callback, int count );
 
       virtual JSValueRef addListener(JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, JSObjectRef callback) {
@@ -77,40 +95,89 @@ namespace NX
         return addManyListener(ctx, thisObject, e, callback, 1);
       }
       virtual JSValueRef addManyListener( JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, JSObjectRef callback, int count );
+      virtual JSValueRef addManyListener( JSGlobalContextRef ctx, JSObjectRef thisObject, EventId e, JSObjectRef callback, int count );
       virtual JSValueRef removeListener( JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, JSObjectRef callback );
       virtual JSValueRef removeAllListeners( JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e );
 
       /* Returns a Promise! (slow) */
       virtual JSObjectRef emit( JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e,
                                 std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception );
+      virtual JSObjectRef emit( JSGlobalContextRef ctx, JSObjectRef thisObject, EventId e,
+                                std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception );
+
+      /**
+       * Calls the listeners inline and returns a promise for those that returned a thenable, so only they cost a promise.
+       * When none did, that's the context's shared resolved promise. A listener that throws rejects it, and what it
+       * resolves to is not the listeners' results: use emit() for those.
+       */
+      virtual JSObjectRef emitInline( JSContextRef ctx, JSObjectRef thisObject, EventId e,
+                                      std::size_t argumentCount, const JSValueRef arguments[] );
 
       /* Fast version that returns schedules the calls and returns the tasks */
       virtual NX::TaskGroup emitFastAndSchedule( JSContextRef ctx, JSObjectRef thisObject, const std::string & e,
                              std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception );
+      virtual NX::TaskGroup emitFastAndSchedule( JSContextRef ctx, JSObjectRef thisObject, EventId e,
+                             std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception );
 
-      /* Faster version that returns nothing */
+      /* Faster version that returns nothing; with an interned id it allocates nothing either */
       virtual void emitFast( JSContextRef ctx, JSObjectRef thisObject, const std::string & e,
                              std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception );
+      virtual void emitFast( JSContextRef ctx, JSObjectRef thisObject, EventId e,
+                             std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception );
 
 
-      static const JSClassDefinition EventCallbackClass;
-
     protected:
-      virtual void tidy(JSContextRef ctx, const std::string & e);
+      // drops the listeners that have run out of calls
+      virtual void tidy(JSContextRef ctx);
 
     WTF_MAKE_FAST_ALLOCATED;
 
     private:
       struct Event: public boost::noncopyable {
-        Event(std::string name, NX::Object && handler, int count):
-          name(std::move(name)), handler(handler), count(count) { }
-        std::string name;
+        Event(EventId id, NX::Object && handler, int count):
+          id(id), handler(handler), callback(), count(count) { }
+        Event(EventId id, EventCallback && callback, int count):
+          id(id), handler(), callback(std::move(callback)), count(count) { }
+        JSValueRef call(JSContextRef ctx, std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception) const;
+        // takes one of a limited listener's calls; false once they've all been used up, maybe by another thread
+        bool claim(bool & last) {
+          int left = count.load();
+          while (left > 0 && !count.compare_exchange_weak(left, left - 1));
+          last = left == 1;
+          return left != 0;
+        }
+        EventId id;
+        // either a script function, or a native callback
         NX::Object handler;
+        EventCallback callback;
         std::atomic_int count;
         WTF_MAKE_FAST_ALLOCATED;
       };
-      std::unordered_map<std::string, std::vector<std::shared_ptr<NX::Classes::Emitter::Event>>> myMap;
-      boost::shared_mutex myTidyLock;
+      // every listener of every event in one flat array, in the order they were added; emitters only ever have a few
+      struct Slot {
+        EventId id;
+        std::shared_ptr<Event> event;
+      };
+
+      /**
+       * The listener table is copy-on-write: emitting reads whatever table is current without taking a lock, and every
+       * change publishes a new copy. A table stays alive for as long as an emit holds a reference to it.
+       */
+      struct Table {
+        explicit Table(std::vector<Slot> slots): slots(std::move(slots)), references(1) {}
+        std::vector<Slot> slots;
+        std::atomic_int references;
+        WTF_MAKE_FAST_ALLOCATED;
+      };
+      Table * acquire();
+      static void release(Table * table);
+      void update(const std::function<void(std::vector<Slot> &)> & change);
+
+      std::atomic<Table*> myTable;
+      // only guards taking a reference on the current table; nothing else runs in between
+      std::atomic_uint myEpoch;
+      std::atomic_int myReaders[2];
+      std::mutex myWriteLock;
     };
   }
 }
@@ -48,6 +48,12 @@ namespace NX
         virtual bool deviceOpen() const = 0;
         virtual void deviceClose() = 0;
 
+        /**
+         * Whether deviceRead() and deviceWrite() may block in the kernel. If so, read() and write() run them on
+         * the scheduler's blocking pool rather than on a thread that could be running JavaScript instead.
+         */
+        virtual bool deviceBlocking() const { return false; }
+
         virtual const boost::system::error_code & deviceError() const = 0;
 
         static NX::Classes::IO::Device * FromObject(JSObjectRef obj) {
@@ -75,6 +75,7 @@ namespace NX {
 
           bool deviceReady() const override { return myStream.good(); }
           bool deviceOpen() const override { return myStream.is_open(); }
+          bool deviceBlocking() const override { return true; }
 
           void deviceClose() override { myStream.close(); }
 
@@ -249,6 +250,7 @@ namespace NX {
           }
           bool deviceOpen() const override { return myStream.is_open(); }
           void deviceClose() override { myStream.close(); }
+          bool deviceBlocking() const override { return true; }
 
           std::size_t deviceSeek(std::size_t pos, Position from) override {
             myStream.seekp(pos, (std::ios_base::seekdir)from);
@@ -120,6 +120,8 @@ namespace NX {
           std::size_t recommendedWriteBufferSize() const override { return maxWriteBufferSize(); }
           bool eof() const override { return !mySocket->is_open(); }
           std::size_t deviceWrite ( const char * buffer, std::size_t length ) override;
+          // deviceWrite() is a blocking send(), which stalls for as long as the peer doesn't read
+          bool deviceBlocking() const override { return true; }
           JSObjectRef pause ( JSContextRef ctx, JSObjectRef thisObject ) override;
           JSObjectRef reset ( JSContextRef ctx, JSObjectRef thisObject ) override;
           JSObjectRef resume ( JSContextRef ctx, JSObjectRef thisObject ) override;
@@ -26,6 +26,11 @@
 #include <JavaScriptCore/API/JSValueRef.h>
 
 #include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
 #include <vector>
 
 namespace NX {
@@ -38,6 +43,61 @@ namespace NX {
       Promise() = default;
       virtual ~Promise() = default;
     public:
+      /**
+       * What a Promise object is underneath. Settling is lock-free and may happen on any thread: the first resolve()
+       * or reject() wins, and the continuations registered by then() up to that point are queued together as one task.
+       */
+      class State: public std::enable_shared_from_this<State>, public boost::noncopyable {
+      public:
+        enum Status { PENDING, ADOPTING, SETTLING, RESOLVED, REJECTED };
+        typedef std::function<void(JSContextRef, Status, JSValueRef)> Continuation;
+
+        explicit State(NX::Context * context);
+        ~State();
+
+        NX::Context * context() const { return myContext; }
+        Status status() const { return Status(myStatus.load(std::memory_order_acquire)); }
+        // only meaningful once settled
+        JSValueRef value() const { return myValue; }
+
+        /**
+         * Resolving with another Promise follows it instead. Returns false if the outcome was already decided.
+         */
+        bool resolve(JSValueRef value);
+        bool reject(JSValueRef value);
+
+        /**
+         * Runs 'continuation' once the promise is settled, as a task, or straight away if it already is. An 'immediate'
+         * continuation runs on the thread that settles the promise instead; it must not call into script.
+         */
+        void then(Continuation && continuation, bool immediate = false);
+
+      private:
+        struct Subscriber {
+          Continuation continuation;
+          bool immediate;
+          Subscriber * next;
+        };
+
+        bool settle(int from, Status status, JSValueRef value);
+        void dispatch(Subscriber * subscribers);
+
+        static Subscriber Closed;
+
+        NX::Context * myContext;
+        std::atomic<int> myStatus;
+        JSValueRef myValue;
+        std::atomic<Subscriber*> mySubscribers;
+        std::atomic_bool myHandled;
+      };
+
+      /**
+       * A new pending Promise object, and the state to settle it through.
+       */
+      static JSObjectRef create(JSContextRef ctx, std::shared_ptr<State> & state);
+
+      // the state behind a Promise object, or nullptr for any other value
+      static std::shared_ptr<State> FromObject(JSContextRef ctx, JSValueRef value);
 
       static JSValueRef Get(JSContextRef ctx, JSObjectRef object, JSStringRef propertyName, JSValueRef * exception);
       static constexpr JSStaticValue GetStaticProperty() {
@@ -50,11 +110,51 @@ namespace NX {
       static JSValueRef createPromise(JSContextRef ctx, JSObjectRef executor, JSValueRef * exception);
       static JSObjectRef createPromise(JSContextRef ctx, const Executor & executor);
       static JSObjectRef all( JSContextRef ctx, const std::vector< JSValueRef > & promises );
+      static JSObjectRef race( JSContextRef ctx, const std::vector< JSValueRef > & promises );
       static JSObjectRef resolve( JSContextRef ctx, JSValueRef value );
       static JSObjectRef reject( JSContextRef ctx, JSValueRef value );
+
+      /**
+       * A native promise that follows 'value' if it's a thenable (such as the promise an async function returns),
+       * or nullptr for anything else. Native promises come back as they are.
+       */
+      static JSObjectRef fromThenable( JSContextRef ctx, JSValueRef value );
+      // one promise per context, resolved with undefined, for callers that have nothing to wait for
+      static JSObjectRef resolved( JSContextRef ctx );
+
+    private:
+      static const JSClassDefinition Class, ResolverClass, RejecterClass;
+      static const JSStaticFunction Methods[], StaticMethods[];
+      static JSObjectRef Constructor(JSContextRef ctx, JSObjectRef constructor, size_t argumentCount,
+                                     const JSValueRef arguments[], JSValueRef * exception);
     };
   }
   using ResolveRejectHandler = Globals::Promise::ResolveRejectHandler;
+
+  /**
+   * The settling end of a promise created from native code. Creating one never leaves the current coroutine or
+   * waits on a task, and it may be resolved or rejected from any thread, the blocking pool included; the first
+   * outcome wins, later ones are ignored. Copies share the same promise.
+   */
+  class PromiseHandle {
+  public:
+    PromiseHandle(): myState(), myPromise(nullptr) {}
+    explicit PromiseHandle(JSContextRef ctx): myState(), myPromise(Globals::Promise::create(ctx, myState)) {}
+
+    // the object to hand back to script; it isn't protected, so it's only good until the creating call returns
+    JSObjectRef promise() const { return myPromise; }
+    bool settled() const { return myState->status() > Globals::Promise::State::SETTLING; }
+
+    bool resolve(JSValueRef value) const { return myState->resolve(value); }
+    bool reject(JSValueRef value) const { return myState->reject(value); }
+    bool reject(const std::exception & e) const;
+
+    explicit operator bool() const { return bool(myState); }
+
+  private:
+    std::shared_ptr<Globals::Promise::State> myState;
+    JSObjectRef myPromise;
+  };
 }
 
 #endif // GLOBALS_PROMISE_H
@@ -0,0 +1,139 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace NX
+{
+  /**
+   * Log-linear histogram in the spirit of HdrHistogram: values are bucketed by their highest set bit, and every
+   * power of two is split into a few linear sub-buckets, so any value is known to within 1/8th of itself
+   * across the whole 64-bit range, in a fixed 4 KiB.
+   *
+   * record() expects a single writer at a time and does plain relaxed stores, no locked instructions, so it's cheap
+   * enough to leave on; writers that do race may drop the odd sample. Reading while a writer records gives a
+   * consistent enough picture for monitoring, not an exact snapshot.
+   */
+  class Histogram {
+  public:
+    static constexpr unsigned SubBucketBits = 3;
+    static constexpr unsigned SubBuckets = 1u << SubBucketBits;
+    static constexpr unsigned BucketCount = (64 - SubBucketBits + 1) * SubBuckets;
+
+  public:
+    Histogram(): myBuckets(), myCount(0), mySum(0), myMax(0) {
+      for(auto & bucket : myBuckets)
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    Histogram(const Histogram & other): Histogram() { merge(other); }
+    Histogram & operator = (const Histogram & other) {
+      if (this != &other) {
+        clear();
+        merge(other);
+      }
+      return *this;
+    }
+
+    void record(std::uint64_t value) {
+      increment(myBuckets[index(value)], 1);
+      increment(myCount, 1);
+      increment(mySum, value);
+      if (value > myMax.load(std::memory_order_relaxed))
+        myMax.store(value, std::memory_order_relaxed);
+    }
+
+    void merge(const Histogram & other) {
+      for(unsigned i = 0; i < BucketCount; i++) {
+        if (std::uint64_t count = other.myBuckets[i].load(std::memory_order_relaxed))
+          myBuckets[i].fetch_add(count, std::memory_order_relaxed);
+      }
+      myCount.fetch_add(other.count(), std::memory_order_relaxed);
+      mySum.fetch_add(other.mySum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      std::uint64_t max = myMax.load(std::memory_order_relaxed), otherMax = other.max();
+      while (otherMax > max && !myMax.compare_exchange_weak(max, otherMax, std::memory_order_relaxed));
+    }
+
+    void clear() {
+      for(auto & bucket : myBuckets)
+        bucket.store(0, std::memory_order_relaxed);
+      myCount.store(0, std::memory_order_relaxed);
+      mySum.store(0, std::memory_order_relaxed);
+      myMax.store(0, std::memory_order_relaxed);
+    }
+
+    std::uint64_t count() const { return myCount.load(std::memory_order_relaxed); }
+    std::uint64_t max() const { return myMax.load(std::memory_order_relaxed); }
+    double mean() const {
+      std::uint64_t count = this->count();
+      return count ? double(mySum.load(std::memory_order_relaxed)) / count : 0;
+    }
+
+    /**
+     * The smallest value that at least 'percentile' percent of all recorded values don't exceed,
+     * give or take the width of its bucket.
+     */
+    std::uint64_t percentile(double percentile) const {
+      std::uint64_t count = 0;
+      for(unsigned i = 0; i < BucketCount; i++)
+        count += myBuckets[i].load(std::memory_order_relaxed);
+      if (!count)
+        return 0;
+      std::uint64_t rank = std::uint64_t(percentile / 100.0 * count + 0.5), seen = 0;
+      if (!rank)
+        rank = 1;
+      for(unsigned i = 0; i < BucketCount; i++) {
+        seen += myBuckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+          return std::min(highest(i), max());
+      }
+      return max();
+    }
+
+  private:
+    static void increment(std::atomic<std::uint64_t> & counter, std::uint64_t value) {
+      counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static unsigned index(std::uint64_t value) {
+      if (value < SubBuckets)
+        return unsigned(value);
+      unsigned shift = 63 - __builtin_clzll(value) - SubBucketBits;
+      return (shift + 1) * SubBuckets + unsigned((value >> shift) & (SubBuckets - 1));
+    }
+
+    static std::uint64_t highest(unsigned index) {
+      if (index < SubBuckets)
+        return index;
+      unsigned shift = index / SubBuckets - 1;
+      std::uint64_t lowest = std::uint64_t(SubBuckets + index % SubBuckets) << shift;
+      return lowest + ((std::uint64_t(1) << shift) - 1);
+    }
+
+  private:
+    std::atomic<std::uint64_t> myBuckets[BucketCount];
+    std::atomic<std::uint64_t> myCount, mySum, myMax;
+  };
+}
+
+#endif // HISTOGRAM_H
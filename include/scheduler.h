@@ -35,9 +35,15 @@
 #include <boost/thread/recursive_mutex.hpp>
 
 #include <thread>
+#include <deque>
+#include <exception>
+#include <list>
+#include <memory>
 #include <WTF/wtf/ThreadGroup.h>
 #include <WTF/wtf/PriorityQueue.h>
 #include "exception.h"
+#include "histogram.h"
+#include "timer_wheel.h"
 
 namespace NX
 {
@@ -45,41 +51,234 @@ namespace NX
   class AbstractTask;
   class Task;
   class CoroutineTask;
+  class TaskGroup;
   class Scheduler: public boost::noncopyable
   {
   public:
     typedef boost::asio::deadline_timer timer_type;
     typedef timer_type::duration_type duration;
     typedef std::function<void(void)> CompletionHandler;
+    typedef std::function<void(std::size_t, std::size_t)> RangeHandler;
+    typedef std::function<void(std::exception_ptr)> JoinHandler;
     typedef boost::lockfree::queue<NX::AbstractTask*> TaskQueue;
+    typedef NX::TimerWheel::Id TimerId;
+
+    /**
+     * Every queue is split into one lane per priority. A lower lane is only looked at once the ones above it are
+     * empty, except that every few picks it goes first, so under overload background work slows down but never
+     * stops: default work gets at least one pick in DefaultShare, background work one in BackgroundShare.
+     */
+    enum Priority { INTERACTIVE, DEFAULT, BACKGROUND };
+    static constexpr unsigned PriorityCount = 3;
+    static constexpr std::size_t DefaultShare = 8, BackgroundShare = 32;
+
+    /**
+     * A point-in-time view of the scheduler, aggregated from per-thread counters when stats() is called.
+     * Latencies are in nanoseconds: queueWait is the time from being scheduled (or yielding) to being picked up,
+     * runTime the time spent in a single run of a task. To keep clock reads off the fast path, only one task in
+     * SampleInterval is timed; the counters are exact.
+     */
+    static constexpr unsigned SampleInterval = 8;
+
+    struct Stats {
+      std::size_t threads, queued, active;
+      std::vector<std::uint64_t> executed; // tasks run, one entry per worker slot and a last one for threads without
+      std::uint64_t steals, parks, yields, cancelled, preemptions;
+      std::uint64_t timersScheduled, timersFired, timersCancelled;
+      std::size_t timersActive;
+      NX::Histogram queueWait, runTime;
+      struct {
+        std::size_t threads, queued;
+        std::uint64_t executed;
+        NX::Histogram queueWait, runTime;
+      } blocking;
+    };
+
+    /**
+     * Runs the handlers given to it one at a time and in order, much like an asio strand, without tying up a thread
+     * in between: whoever schedules onto an idle strand queues a single task that works through its backlog, so a
+     * strand stays on one thread for as long as it has work, and state only it touches needs no locking.
+     */
+    class Strand: public std::enable_shared_from_this<Strand>, public boost::noncopyable {
+    public:
+      explicit Strand(Scheduler * scheduler): myScheduler(scheduler), myLock(), myHandlers(), myScheduled(false) {}
+
+      void schedule(CompletionHandler && handler);
+
+      /**
+       * A handler that schedules 'handler' on this strand whenever it's called, for passing on as a callback.
+       */
+      CompletionHandler wrap(CompletionHandler && handler);
+
+      /**
+       * Whether the calling thread is running one of this strand's handlers right now.
+       */
+      bool current() const { return Current == this; }
+
+    private:
+      static constexpr std::size_t Batch = 64;
+      static thread_local const Strand * Current;
+
+      void run();
+
+      Scheduler * myScheduler;
+      boost::mutex myLock;
+      std::deque<CompletionHandler> myHandlers;
+      bool myScheduled;
+    };
+
   public:
-    Scheduler(NX::Nexus *, unsigned int maxThreads);
+    /**
+     * The pool grows up to maxThreads while there is queued work that no idle thread can pick up.
+     * A pool thread that stays idle for idleTimeout exits, as long as more than minThreads remain.
+     */
+    Scheduler(NX::Nexus *, unsigned int maxThreads, unsigned int minThreads = 1,
+              const duration & idleTimeout = boost::posix_time::seconds(5));
     virtual ~Scheduler();
   public:
+    /**
+     * Thread placement, to be set before start(). With 'affinity' every pool thread is pinned to a CPU of its own.
+     * With 'numa' each worker stays on one NUMA node (on the whole node, unless also pinned), and idle threads
+     * steal from workers on their own node before reaching across.
+     */
+    void setPlacement(bool affinity, bool numa);
+
+    /**
+     * Gives every worker an I/O service of its own, to be set before start(). Each new socket, acceptor or
+     * resolver is then bound to one of them in turn by service(), and its completions run on that worker's thread
+     * instead of on whichever thread got to the shared reactor first. The pool is fixed at its maximum size in this
+     * mode, since every reactor needs a thread to run it.
+     */
+    void setShardedIO(bool sharded);
+
+    /**
+     * Caps the blocking pool (see scheduleBlocking()), which starts empty and grows as work comes in.
+     */
+    void setBlockingConcurrency(unsigned int maxThreads) { myBlockingMaxThreads = std::max(maxThreads, 1u); }
+
+    /**
+     * How long a coroutine may run before the next safe point (see checkpoint()) sends it to the back of its queue.
+     * Zero, the default, turns time slicing off.
+     */
+    void setTaskSlice(const duration & slice) {
+      myTaskSlice = slice.is_negative() ? 0 : std::uint64_t(slice.total_microseconds()) * 1000;
+    }
     void start();
     void pause() { myPauseTasks.store(true); }
-    void resume() { myPauseTasks.store(false); }
+    void resume() { myPauseTasks.store(false); notifyAll(); }
     void stop();
     void join();
     void joinPool(const CompletionHandler & drainTasks);
 
     NX::AbstractTask * scheduleAbstractTask(NX::AbstractTask * task);
+    void scheduleAbstractTasks(const std::vector<NX::AbstractTask*> & tasks);
+
+    /**
+     * Called by abort() before anybody can see the task aborted. Takes a queued task out of the run queue in O(1):
+     * it stops counting as queued right away, and becomes a tombstone that the thread that eventually pops it
+     * disposes of without running, while abort() releases its body and everything it captured.
+     * Returns false if the task wasn't queued.
+     */
+    bool unschedule(NX::AbstractTask * task);
+
+    NX::Task * scheduleTask(CompletionHandler && handler, Priority priority = DEFAULT);
+    NX::CoroutineTask * scheduleCoroutine(CompletionHandler && handler, Priority priority = DEFAULT);
+
+    /**
+     * Queues every handler as a task at once: the queue counter is updated once, the local deque is locked once,
+     * and idle threads get one wake-up pass for the whole batch rather than one per task. If 'group' is given,
+     * every task joins it before any of them is queued.
+     */
+    void scheduleBatch(std::vector<CompletionHandler> && handlers, NX::TaskGroup * group = nullptr);
 
-    NX::Task * scheduleTask(CompletionHandler && handler);
-    NX::Task * scheduleTask(const duration & time, CompletionHandler && handler);
-    NX::CoroutineTask * scheduleCoroutine(CompletionHandler && handler);
-    NX::CoroutineTask * scheduleCoroutine(const duration & time, CompletionHandler && handler);
+    /**
+     * Timed variants. The task waits in the timer wheel until it's due; if it's aborted or its timer is cancelled
+     * before then, it's freed as soon as the abort is over and the returned pointer must not be used any more.
+     */
+    NX::Task * scheduleTask(const duration & time, CompletionHandler && handler, Priority priority = DEFAULT);
+    NX::CoroutineTask * scheduleCoroutine(const duration & time, CompletionHandler && handler, Priority priority = DEFAULT);
+
+    /**
+     * Same as above, but the callable goes straight into the task's inline storage instead of
+     * being wrapped in a std::function first. Defined in task.h.
+     */
+    template <typename Handler>
+    NX::Task * scheduleTask(Handler && handler, Priority priority = DEFAULT);
+    template <typename Handler>
+    NX::CoroutineTask * scheduleCoroutine(Handler && handler, Priority priority = DEFAULT);
 
     NX::Task * scheduleThreadInitTask(CompletionHandler && handler);
 
+    /**
+     * Runs 'work' on the blocking pool: threads of its own, with a queue of its own, for calls that may block in
+     * the kernel (file I/O, stat(), a send() to a slow peer), so they can't tie up the threads that run tasks.
+     * 'work' must not touch JavaScript. 'then', if given, is queued as a regular task once 'work' returns; that's
+     * where results get handed back. The scheduler is held in the meantime.
+     */
+    void scheduleBlocking(CompletionHandler && work, CompletionHandler && then = CompletionHandler(),
+                          Priority priority = DEFAULT);
+
+    /**
+     * Splits [begin, end) into chunks of 'grain' indices and runs 'body' on each of them as a task of its own.
+     * 'then' runs once, on whichever thread finishes the last chunk, and is handed the first exception a chunk threw
+     * (the other chunks still run). A grain of 0 is replaced with grainFor(end - begin).
+     */
+    void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, RangeHandler && body, JoinHandler && then,
+                     Priority priority = DEFAULT);
+
+    /**
+     * A grain that splits 'count' indices into a few chunks per thread, so that one slow chunk doesn't hold up
+     * the whole loop while the other threads sit idle.
+     */
+    std::size_t grainFor(std::size_t count) const {
+      std::size_t chunks = std::max<std::size_t>(myMaxThreads, 1) * ChunksPerThread;
+      return std::max<std::size_t>((count + chunks - 1) / chunks, 1);
+    }
+
+    std::shared_ptr<Strand> strand() { return std::make_shared<Strand>(this); }
+
+    /**
+     * Runs the handler once the delay has passed, and then every 'interval' if one is given.
+     * Intervals are measured from the previous deadline, so they don't drift.
+     * The returned id is never 0, and stays unique for as long as the timer is alive.
+     */
+    TimerId scheduleTimer(const duration & delay, CompletionHandler && handler, const duration & interval = duration());
+
+    /**
+     * Cancels a timer created by scheduleTimer(), or by the timed variants of scheduleTask() and scheduleCoroutine().
+     * Returns false if it already fired or was cancelled. A timed task is aborted and freed along with its timer.
+     */
+    bool cancelTimer(TimerId id);
+
+    /**
+     * Runs the handler as a regular task and yields the calling coroutine until it's done.
+     * Unlike scheduleTask(...)->await(), this never touches a task that another thread may have already finished.
+     */
+    void awaitTask(CompletionHandler && handler);
+
     void yield();
 
+    /**
+     * A safe point for time slicing: yields the calling coroutine if it has used up its slice, and returns whether
+     * it did. Costs a single test while slicing is off; regular tasks have no stack to switch away from, and
+     * always run to completion.
+     */
+    bool checkpoint() { return myTaskSlice && preempt(); }
+
+    /**
+     * Suspends the calling coroutine until it is resumed, without requeueing it while it waits. 'arm' is handed
+     * the handler that resumes it, to pass on to whatever is being waited for. Only the first call to that handler
+     * counts, and it may come from any thread, or from within 'arm' itself.
+     */
+    void suspend(const std::function<void(const CompletionHandler &)> & arm);
+
     NX::Nexus * nexus() { return myNexus; }
 
     std::size_t concurrency() const { return myThreadCount; }
     std::size_t queued() const { return myTaskCount; }
     std::size_t active() const { return myActiveTaskCount; }
     std::size_t remaining() const { return (std::size_t)myTaskCount + (std::size_t)myActiveTaskCount; }
+    Stats stats();
 
     struct Holder {
       Holder();
@@ -94,10 +293,17 @@ namespace NX
     };
 
     void hold() { myHoldCount++; }
-    void release() { myHoldCount--; }
+    void release() { if (!--myHoldCount) notifyAll(); }
 
-    const std::shared_ptr<boost::asio::io_service> service() const { return myService; }
-    std::shared_ptr<boost::asio::io_service> service() { return myService; }
+    /**
+     * The I/O service to bind a new I/O object to: the shared one, or with sharded I/O the next worker's.
+     */
+    std::shared_ptr<boost::asio::io_service> service() const {
+      if (!myShardedIO)
+        return myService;
+      // pool slots only, the one for the thread calling joinPool() may go unattended for a while
+      return myWorkers[myNextService++ % myMaxThreads]->service();
+    }
 
     /**
      * Internal use only!
@@ -107,22 +313,229 @@ namespace NX
     bool canYield() const;
 
   protected:
+    /**
+     * Written by the thread that owns the worker, without locked instructions. The shared block for threads that
+     * couldn't claim a worker is only used while the pool is changing size, and may drop a count when they race.
+     */
+    struct Counters {
+      Counters(): executed(0), steals(0), parks(0), yields(0), cancelled(0), preemptions(0), queueWait(), runTime() {}
+      static void increment(std::atomic<std::uint64_t> & counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+      std::atomic<std::uint64_t> executed, steals, parks, yields, cancelled, preemptions;
+      NX::Histogram queueWait, runTime;
+    };
+
+    /**
+     * Per-thread task deque. The owning thread pushes and pops at the back (LIFO), while
+     * other threads steal from the front. Each deque has its own lock, so the owner only
+     * ever contends with an occasional thief rather than with every thread in the pool.
+     */
+    class alignas(64) Worker: public boost::noncopyable {
+    public:
+      explicit Worker(unsigned int seed): myActive(false), myTicks(0), mySeed(seed ? seed : 1), myCpus(), myNode(0),
+                                          myLock(), myTasks(), myService(), myWork(), myParked(false) {}
+
+      bool claim() { bool expected = false; return myActive.compare_exchange_strong(expected, true); }
+      void unclaim() { myActive.store(false); }
+
+      void push(NX::AbstractTask * task) {
+        boost::mutex::scoped_lock lock(myLock);
+        myTasks[lane(task)].push_back(task);
+      }
+      template <typename Iterator>
+      void push(Iterator begin, Iterator end) {
+        boost::mutex::scoped_lock lock(myLock);
+        for(; begin != end; ++begin)
+          myTasks[lane(*begin)].push_back(*begin);
+      }
+      void pushFront(NX::AbstractTask * task) {
+        boost::mutex::scoped_lock lock(myLock);
+        myTasks[lane(task)].push_front(task);
+      }
+      // leaves the deque alone if the best it has is less urgent than 'limit', unless that's the favoured lane
+      NX::AbstractTask * pop(unsigned favoured, unsigned limit) {
+        boost::mutex::scoped_lock lock(myLock);
+        std::deque<NX::AbstractTask*> * tasks = pick(favoured);
+        if (!tasks) return nullptr;
+        unsigned lane = unsigned(tasks - myTasks);
+        if (lane > limit && lane != favoured) return nullptr;
+        NX::AbstractTask * task = tasks->back();
+        tasks->pop_back();
+        return task;
+      }
+      NX::AbstractTask * steal(unsigned favoured = INTERACTIVE) {
+        boost::mutex::scoped_lock lock(myLock);
+        std::deque<NX::AbstractTask*> * tasks = pick(favoured);
+        if (!tasks) return nullptr;
+        NX::AbstractTask * task = tasks->front();
+        tasks->pop_front();
+        return task;
+      }
+
+      void place(std::vector<int> cpus, int node) { myCpus = std::move(cpus); myNode = node; }
+      const std::vector<int> & cpus() const { return myCpus; }
+      int node() const { return myNode; }
+      // rebuilds the deque from the calling thread, so that first-touch puts its memory on that thread's node
+      void localize() {
+        boost::mutex::scoped_lock lock(myLock);
+        for(auto & queue : myTasks) {
+          std::deque<NX::AbstractTask*> tasks(queue.begin(), queue.end());
+          queue.swap(tasks);
+        }
+      }
+
+      Counters & counters() { return myCounters; }
+
+      const std::shared_ptr<boost::asio::io_service> & service() const { return myService; }
+      void setService(const std::shared_ptr<boost::asio::io_service> & service) { myService = service; }
+      void startService() { myService->reset(); myWork.reset(new boost::asio::io_service::work(*myService)); }
+      void stopService() { myWork.reset(); myService->stop(); }
+      // a parked worker sleeps on its own reactor; whoever clears the flag first owes it a wake-up
+      void park() { myParked.store(true); }
+      bool unpark() { return myParked.exchange(false); }
+
+      std::size_t tick() { return ++myTicks; }
+      unsigned int random() {
+        mySeed ^= mySeed << 13;
+        mySeed ^= mySeed >> 17;
+        mySeed ^= mySeed << 5;
+        return mySeed;
+      }
+
+    private:
+      std::deque<NX::AbstractTask*> * pick(unsigned favoured) {
+        if (!myTasks[favoured].empty())
+          return &myTasks[favoured];
+        for(auto & queue : myTasks) {
+          if (!queue.empty())
+            return &queue;
+        }
+        return nullptr;
+      }
+
+    private:
+      std::atomic_bool myActive;
+      std::size_t myTicks;
+      unsigned int mySeed;
+      std::vector<int> myCpus;
+      int myNode;
+      boost::mutex myLock;
+      std::deque<NX::AbstractTask*> myTasks[PriorityCount];
+      Counters myCounters;
+      std::shared_ptr<boost::asio::io_service> myService;
+      std::shared_ptr<boost::asio::io_service::work> myWork;
+      std::atomic_bool myParked;
+    };
+
+    /**
+     * The task running on the calling thread. boost::thread_specific_ptr allocates every time it goes from
+     * empty to set, which here is once per task, so this is backed by a plain thread_local instead.
+     */
+    class CurrentTask {
+    public:
+      NX::AbstractTask * get() const { return current; }
+      NX::AbstractTask * operator->() const { return current; }
+      void reset(NX::AbstractTask * task) { current = task; }
+      NX::AbstractTask * release() { NX::AbstractTask * task = current; current = nullptr; return task; }
+      // when the running coroutine got the thread, or 0 if its time isn't being sliced
+      std::uint64_t enteredAt() const { return entered; }
+      void enter(std::uint64_t at) { entered = at; }
+    private:
+      static thread_local NX::AbstractTask * current;
+      static thread_local std::uint64_t entered;
+    };
+
+    static constexpr std::size_t DrainBatch = 256;
+    static constexpr std::size_t ChunksPerThread = 4;
+
+    static unsigned lane(const NX::AbstractTask * task);
+    static unsigned favouredLane(std::size_t tick) {
+      return tick % BackgroundShare == 0 ? BACKGROUND : tick % DefaultShare == 0 ? DEFAULT : INTERACTIVE;
+    }
+
     void addThread();
+    void reapThreads();
+    bool retireThread();
+    bool needThread() const;
     void balanceThreads();
-    void dispatcher();
+    void dispatcher(const CompletionHandler & idleHandler, bool pooled);
     std::size_t drainTasks();
+
+    bool park(bool joining);
+    void notify(std::size_t count = 1);
+    void notifyAll();
+    void wake();
+    void wake(Worker * worker);
+    void postWakeup();
+    std::chrono::milliseconds untilTimer(const std::chrono::milliseconds & timeout) const;
+
+    Worker * attachWorker(bool pin);
+    void detachWorker(Worker * worker);
+    void requeueTask(NX::AbstractTask * task);
+    NX::AbstractTask * nextTask();
+    NX::AbstractTask * stealTask(Worker * thief, unsigned favoured);
+    NX::AbstractTask * popInjected(unsigned favoured);
+    unsigned injectedLane() const;
+    bool claimTask(NX::AbstractTask * task);
+    Counters & counters();
+    static std::uint64_t now();
+    static std::uint64_t sampleTime();
+    bool preempt();
+
+    struct BlockingJob {
+      CompletionHandler work, then;
+      Priority priority;
+      std::uint64_t queuedAt;
+    };
+    void blockingDispatcher();
+    void stopBlockingThreads();
+
+    TimerId addTimer(const duration & delay, NX::AbstractTask * task,
+                     const duration & interval = duration(), const CompletionHandler & handler = CompletionHandler());
+    void armTimer();
+    void expireTimers(const boost::system::error_code & error);
+    void dispatchTimers(std::vector<NX::TimerWheel::Expired> & expired);
+    NX::TimerWheel::Tick toTick(const std::chrono::steady_clock::time_point & time, bool roundUp) const;
   private:
     NX::Nexus * myNexus;
     std::atomic_size_t myMaxThreads;
-    std::atomic_size_t myThreadCount;
+    std::size_t myMinThreads;
+    std::chrono::milliseconds myIdleTimeout;
+    std::atomic_size_t myThreadCount, myPoolSize, myStartingThreads;
     std::shared_ptr<boost::asio::io_service> myService;
     std::shared_ptr<boost::asio::io_service::work> myWork;
-    boost::thread_group myThreadGroup;
-    boost::thread_specific_ptr<NX::AbstractTask> myCurrentTask;
-    TaskQueue myTaskQueue;
+    std::chrono::steady_clock::time_point myTimerEpoch;
+    std::unique_ptr<boost::asio::steady_timer> myTimer;
+    std::atomic<NX::TimerWheel::Tick> myTimerArmedAt;
+    NX::TimerWheel myTimerWheel;
+    boost::mutex myTimerLock;
+    std::uint64_t myTimersScheduled, myTimersFired, myTimersCancelled;
+    std::list<boost::thread> myThreads;
+    std::list<boost::thread> myRetiredThreads;
+    boost::mutex myThreadsLock;
+    CurrentTask myCurrentTask;
+    boost::thread_specific_ptr<Worker> myCurrentWorker;
+    std::vector<std::unique_ptr<Worker>> myWorkers;
+    bool myNodeLocal;
+    bool myShardedIO;
+    mutable std::atomic_size_t myNextService;
+    std::atomic<Worker*> myTimerWatcher;
+    Counters mySharedCounters;
+    std::unique_ptr<TaskQueue> myInjectionQueues[PriorityCount];
     std::vector<NX::AbstractTask*> myThreadInitQueue;
     std::atomic_size_t myTaskCount, myActiveTaskCount, myHoldCount;
+    std::atomic_size_t myIdleCount, myPendingWakeups, myServiceIdleCount;
     std::atomic_bool myPauseTasks;
+    boost::mutex myBlockingLock;
+    boost::condition_variable myBlockingCondition;
+    std::deque<BlockingJob> myBlockingQueue;
+    std::list<boost::thread> myBlockingThreads;
+    std::size_t myBlockingMaxThreads, myBlockingIdle;
+    bool myBlockingStopped;
+    std::uint64_t myBlockingExecuted;
+    NX::Histogram myBlockingQueueWait, myBlockingRunTime;
+    std::uint64_t myTaskSlice;
   };
 }
 #endif // SCHEDULER_H
@@ -0,0 +1,62 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STACK_POOL_H
+#define STACK_POOL_H
+
+#include <boost/context/stack_context.hpp>
+
+#include <cstddef>
+
+namespace NX
+{
+  /**
+   * Recycles coroutine stacks. Every stack is a fixed-size mapping with a guard page at its low end, like
+   * boost::context::protected_fixedsize_stack, but instead of being unmapped when its coroutine finishes it
+   * goes to the current thread's cache, or failing that to a small shared one.
+   */
+  class StackPool {
+  public:
+    /**
+     * Sets the stack size (rounded up to whole pages, guard page not included) and the number of stacks
+     * each thread may keep. Must be called before the first coroutine is created.
+     */
+    static void configure(std::size_t stackSize, std::size_t depth);
+
+    static boost::context::stack_context allocate();
+    static void deallocate(boost::context::stack_context & stack);
+
+    static std::size_t stackSize();
+    /**
+     * Stacks handed out from a cache, and stacks that had to be mapped.
+     */
+    static std::size_t hits();
+    static std::size_t misses();
+
+    /**
+     * StackAllocator for boost::coroutines2.
+     */
+    struct Allocator {
+      boost::context::stack_context allocate() { return StackPool::allocate(); }
+      void deallocate(boost::context::stack_context & stack) { StackPool::deallocate(stack); }
+    };
+  };
+}
+
+#endif // STACK_POOL_H
@@ -23,6 +23,9 @@
 #include <boost/noncopyable.hpp>
 #include <boost/coroutine2/all.hpp>
 #include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <new>
 
 #include "scheduler.h"
 #include "exception.h"
@@ -33,29 +36,198 @@ namespace NX
 {
   class Task;
   class CoroutineTask;
-  class AbstractTask: public boost::noncopyable {
 
-    WTF_MAKE_FAST_ALLOCATED;
+  /**
+   * Per-thread free lists for task objects, in 64-byte size classes. A task is usually freed by whichever thread
+   * ran it rather than the one that created it, so blocks drift between threads; each thread keeps a bounded
+   * number of them and returns the rest to fastMalloc.
+   */
+  class TaskPool {
+  public:
+    static void * allocate(std::size_t size);
+    static void deallocate(void * ptr, std::size_t size);
+
+    /**
+     * Task objects that could not be served from a free list.
+     */
+    static std::size_t taskAllocations();
+    /**
+     * Task bodies too big for a TaskHandler's inline buffer.
+     */
+    static std::size_t handlerAllocations();
+
+  private:
+    friend class TaskHandler;
+    static void countHandlerAllocation();
+  };
+
+  /**
+   * Holds a task's body. Callables of up to InlineSize bytes are constructed in place, so scheduling a small
+   * lambda costs no allocation beyond the task itself; larger ones spill to the heap.
+   */
+  class TaskHandler: public boost::noncopyable {
+  public:
+    static constexpr std::size_t InlineSize = 64;
+
+    TaskHandler(): myInvoke(nullptr), myDestroy(nullptr) {}
+
+    TaskHandler(NX::Scheduler::CompletionHandler handler): TaskHandler() {
+      if (handler)
+        assign(std::move(handler));
+    }
+
+    template <typename Handler, typename = typename std::enable_if<
+      !std::is_same<typename std::decay<Handler>::type, TaskHandler>::value &&
+      !std::is_same<typename std::decay<Handler>::type, NX::Scheduler::CompletionHandler>::value>::type>
+    TaskHandler(Handler && handler): TaskHandler() {
+      assign(std::forward<Handler>(handler));
+    }
+
+    ~TaskHandler() { if (myDestroy) myDestroy(myStorage); }
+
+    explicit operator bool() const { return myInvoke != nullptr; }
+    void operator()() { myInvoke(myStorage); }
+
+    void reset() {
+      if (myDestroy)
+        myDestroy(myStorage);
+      myInvoke = nullptr;
+      myDestroy = nullptr;
+    }
+
+  private:
+    template <typename Handler>
+    void assign(Handler && handler) {
+      typedef typename std::decay<Handler>::type Type;
+      if constexpr (sizeof(Type) <= InlineSize && alignof(Type) <= alignof(std::max_align_t)) {
+        new (myStorage) Type(std::forward<Handler>(handler));
+        myInvoke = [](void * storage) { (*static_cast<Type*>(storage))(); };
+        myDestroy = [](void * storage) { static_cast<Type*>(storage)->~Type(); };
+      } else {
+        TaskPool::countHandlerAllocation();
+        *reinterpret_cast<Type**>(myStorage) = new Type(std::forward<Handler>(handler));
+        myInvoke = [](void * storage) { (**static_cast<Type**>(storage))(); };
+        myDestroy = [](void * storage) { delete *static_cast<Type**>(storage); };
+      }
+    }
+
+  private:
+    alignas(std::max_align_t) unsigned char myStorage[InlineSize];
+    void (*myInvoke)(void *);
+    void (*myDestroy)(void *);
+  };
+
+  /**
+   * Completion or cancellation handlers of a task. Almost every task gets at most one of each,
+   * so the first one is kept inline and only the rest go to a vector.
+   *
+   * Handlers are added and run from different threads. The list runs at most once, and a handler added after
+   * that runs right away, so one that races the task's end isn't lost.
+   */
+  class TaskHandlerList {
+  public:
+    TaskHandlerList(): myLock(), myClosed(false), myFirst(), myRest() {}
+
+    void add(const NX::Scheduler::CompletionHandler & handler) {
+      {
+        boost::mutex::scoped_lock lock(myLock);
+        if (!myClosed) {
+          if (!myFirst)
+            myFirst = handler;
+          else
+            myRest.push_back(handler);
+          return;
+        }
+      }
+      handler();
+    }
+
+    void operator()() {
+      NX::Scheduler::CompletionHandler first;
+      std::vector<NX::Scheduler::CompletionHandler> rest;
+      {
+        boost::mutex::scoped_lock lock(myLock);
+        myClosed = true;
+        first.swap(myFirst);
+        rest.swap(myRest);
+      }
+      if (first)
+        first();
+      for(auto & i : rest)
+        i();
+    }
+
+    void clear() {
+      std::vector<NX::Scheduler::CompletionHandler> rest;
+      NX::Scheduler::CompletionHandler first;
+      boost::mutex::scoped_lock lock(myLock);
+      first.swap(myFirst);
+      rest.swap(myRest);
+    }
+
+  private:
+    boost::mutex myLock;
+    bool myClosed;
+    NX::Scheduler::CompletionHandler myFirst;
+    std::vector<NX::Scheduler::CompletionHandler> myRest;
+  };
+
+  class AbstractTask: public boost::noncopyable {
 
     friend class NX::Scheduler;
-    friend class boost::thread_specific_ptr<AbstractTask>;
     friend class Task;
     friend class CoroutineTask;
   protected:
 
     NX::Scheduler::Holder myHolder;
-
-    AbstractTask(NX::Scheduler * scheduler, bool hold): myHolder(hold ? scheduler : nullptr) {}
+    std::uint64_t myQueuedAt;
+    // whether the task sits in one of the scheduler's queues; see Scheduler::unschedule()
+    enum QueueState { UNQUEUED, QUEUED, CANCELLING, CANCELLED };
+    std::atomic<int> myQueueState;
+    // two for every abort() still running on the task, plus one once its owner is done with it; see dispose()
+    std::atomic<unsigned> myAborts;
+    NX::Scheduler::Priority myPriority;
+
+    AbstractTask(NX::Scheduler * scheduler, bool hold): myHolder(hold ? scheduler : nullptr), myQueuedAt(0),
+                                                         myQueueState(UNQUEUED), myAborts(0),
+                                                         myPriority(NX::Scheduler::DEFAULT) {}
+
+    /**
+     * Lets go of the task's body, and of everything it captured, without running it.
+     * Only called on a task that was aborted while it sat in a queue.
+     */
+    virtual void discard() = 0;
+
+    /**
+     * abort() holds on to the task while it runs, so that neither the thread running the task, nor the one that
+     * pops it off a queue, nor the timer wheel can free it from under the cancellation handlers.
+     */
+    void pin() { myAborts.fetch_add(2); }
+    void unpin() { if (myAborts.fetch_sub(2) == 3) delete this; }
+
+    /**
+     * Called by whoever owns the task once it's done with it, instead of delete: frees the task right away, or
+     * leaves that to the last abort() still running on it.
+     */
+    void dispose() { if (!myAborts.fetch_or(1)) delete this; }
+
+    // what's left to do for an abort() that took the task out of its queue
+    void drop() { discard(); myHolder.reset(); }
 
     virtual ~AbstractTask() = default;
 
   public:
 
+    // the destructor is virtual, so the size handed to delete is that of the concrete task
+    static void * operator new(std::size_t size) { return NX::TaskPool::allocate(size); }
+    static void operator delete(void * ptr, std::size_t size) { NX::TaskPool::deallocate(ptr, size); }
+
     enum Status {
       INACTIVE,
       CREATED,
       ACTIVE,
       PENDING,
+      SUSPENDED,
       FINISHED,
       ABORTED,
       UNKNOWN
@@ -73,47 +245,65 @@ namespace NX
 
     virtual void await() = 0;
 
+    NX::Scheduler::Priority priority() const { return myPriority; }
+    // only takes effect the next time the task is queued
+    void setPriority(NX::Scheduler::Priority priority) { myPriority = priority; }
+
   };
 
   class Task: public AbstractTask {
   protected:
     ~Task() override { }
 
-    WTF_MAKE_FAST_ALLOCATED;
-
   public:
-    Task(NX::Scheduler::CompletionHandler && handler, NX::Scheduler * scheduler, bool hold = true):
-      AbstractTask(scheduler, hold), myHandler(std::move(handler)), myScheduler(scheduler), myStatus(INACTIVE)
+    template <typename Handler>
+    Task(Handler && handler, NX::Scheduler * scheduler, bool hold = true):
+      AbstractTask(scheduler, hold), myHandler(std::forward<Handler>(handler)), myScheduler(scheduler), myStatus(INACTIVE)
     {
     }
 
     Scheduler * scheduler() override { return myScheduler; }
     Status status() const override { return myStatus; }
-    void abort() override { myStatus.store(ABORTED); for (auto & i : myCancellationHandlers) i(); }
+    // see CoroutineTask::abort()
+    void abort() override {
+      pin();
+      bool unqueued = myScheduler->unschedule(this);
+      myStatus.store(ABORTED);
+      myCancellationHandlers();
+      if (unqueued)
+        drop();
+      unpin();
+    }
     void create() override { myStatus.store(CREATED); }
     void enter() override;
     void yield() override { throw NX::Exception("can't yield on a regular task"); }
-    void exit() override { for(auto & i : myCompletionHandlers) i(); }
+    void exit() override { myCompletionHandlers(); }
     void addCancellationHandler(const NX::Scheduler::CompletionHandler & handler) override {
-      myCancellationHandlers.push_back(handler);
+      myCancellationHandlers.add(handler);
     }
     void addCompletionHandler(const NX::Scheduler::CompletionHandler & handler) override {
-      myCompletionHandlers.push_back(handler);
+      myCompletionHandlers.add(handler);
     }
 
     void await() override {
       if (myStatus == Status::FINISHED || myStatus == Status::ABORTED)
         return;
-      std::atomic_bool finished(false);
-      myCancellationHandlers.emplace_back([&] { finished.store(true); });
-      myCompletionHandlers.emplace_back([&] { finished.store(true); });
-      while (!finished)
-        myScheduler->yield();
+      myScheduler->suspend([this](const NX::Scheduler::CompletionHandler & resume) {
+        myCancellationHandlers.add(resume);
+        myCompletionHandlers.add(resume);
+      });
     }
 
   protected:
-    NX::Scheduler::CompletionHandler myHandler;
-    std::vector<NX::Scheduler::CompletionHandler> myCancellationHandlers, myCompletionHandlers;
+    void discard() override {
+      myHandler.reset();
+      myCancellationHandlers.clear();
+      myCompletionHandlers.clear();
+    }
+
+  protected:
+    NX::TaskHandler myHandler;
+    NX::TaskHandlerList myCancellationHandlers, myCompletionHandlers;
     NX::Scheduler * myScheduler;
     boost::atomic<Status> myStatus;
   };
@@ -123,63 +313,120 @@ namespace NX
     typedef coro_t::push_type push_type;
     typedef boost::coroutines2::coroutine<void>::pull_type pull_type;
 
-  WTF_MAKE_FAST_ALLOCATED;
-
   protected:
     ~CoroutineTask() override = default;
 
   public:
-    CoroutineTask(NX::Scheduler::CompletionHandler &&, NX::Scheduler *, bool hold = false);
+    template <typename Handler>
+    CoroutineTask(Handler && handler, NX::Scheduler * scheduler, bool hold = false):
+      AbstractTask(scheduler, hold), myHandler(std::forward<Handler>(handler)), myScheduler(scheduler), myCoroutine(),
+      myPullCa(nullptr), myStatus(INACTIVE), myWakeState(RUNNING)
+    {
+    }
 
     Scheduler * scheduler() override { return myScheduler; }
 
     Status status() const override { return myStatus; }
 
-    void abort() override { myStatus.store(ABORTED); for (auto & i : myCancellationHandlers) i(); }
+    // the queue slot is taken before anybody can see the task aborted: a queued coroutine is dropped from its queue
+    // on the spot, a suspended one is woken so it can be disposed of
+    void abort() override {
+      pin();
+      bool unqueued = myScheduler->unschedule(this);
+      myStatus.store(ABORTED);
+      myCancellationHandlers();
+      if (unqueued)
+        drop();
+      else
+        resume();
+      unpin();
+    }
     void create() override;
     void enter() override;
     void yield() override;
-    void exit() override { for (auto & i: myCompletionHandlers) i(); }
+
+    /**
+     * Switches away until resume() is called. Unlike yield(), the coroutine isn't queued in the meantime,
+     * so a long wait costs nothing. Use Scheduler::suspend() rather than calling this directly.
+     */
+    void suspend();
+
+    /**
+     * Queues a suspended coroutine again. Safe from any thread, even before suspend() has had a chance to switch
+     * away: the wake-up is then remembered, and the coroutine carries on without waiting.
+     */
+    void resume();
+
+    /**
+     * Internal use only! Called by the scheduler once the coroutine has switched away. Returns false if it was
+     * resumed in the meantime, in which case the caller queues it again.
+     */
+    bool park();
+    void exit() override { myCompletionHandlers(); }
 
     void addCancellationHandler(const NX::Scheduler::CompletionHandler & handler) override {
-      myCancellationHandlers.push_back(handler);
+      myCancellationHandlers.add(handler);
     }
     void addCompletionHandler(const NX::Scheduler::CompletionHandler & handler) override {
-      myCompletionHandlers.push_back(handler);
+      myCompletionHandlers.add(handler);
     }
 
     void await() override {
       if (myStatus == Status::FINISHED || myStatus == Status::ABORTED)
         return;
-      std::atomic_bool finished(false);
-      myCancellationHandlers.emplace_back([&] { finished.store(true); });
-      myCompletionHandlers.emplace_back([&] { finished.store(true); });
-      while (!finished)
-        myScheduler->yield();
+      myScheduler->suspend([this](const NX::Scheduler::CompletionHandler & resume) {
+        myCancellationHandlers.add(resume);
+        myCompletionHandlers.add(resume);
+      });
     }
 
   protected:
     void coroutine(pull_type & ca);
+    void discard() override;
   protected:
-    NX::Scheduler::CompletionHandler myHandler;
-    std::vector<NX::Scheduler::CompletionHandler> myCancellationHandlers, myCompletionHandlers;
+    NX::TaskHandler myHandler;
+    NX::TaskHandlerList myCancellationHandlers, myCompletionHandlers;
     NX::Scheduler * myScheduler;
     std::shared_ptr<push_type> myCoroutine;
     pull_type * myPullCa;
     boost::atomic<Status> myStatus;
+    enum WakeState { RUNNING, PARKED, WOKEN };
+    std::atomic<int> myWakeState;
   };
 
   class TaskGroup: public std::vector<NX::AbstractTask*> {
+    /**
+     * Shared with the handlers attached to every task, which may outlive the group.
+     */
+    struct State {
+      State(): lock(), finished(0), awaited(0), waiter() {}
+
+      void finish() {
+        NX::Scheduler::CompletionHandler resume;
+        {
+          boost::mutex::scoped_lock guard(lock);
+          if (++finished < awaited || !waiter)
+            return;
+          resume.swap(waiter);
+        }
+        resume();
+      }
+
+      boost::mutex lock;
+      std::size_t finished, awaited;
+      NX::Scheduler::CompletionHandler waiter;
+    };
+
   public:
     explicit TaskGroup(NX::Scheduler * scheduler): std::vector<NX::AbstractTask*>(), myScheduler(scheduler),
-                                                   myFinished(nullptr) { attach(); }
+                                                   myState(nullptr) { attach(); }
     TaskGroup(std::vector<NX::AbstractTask*> tasks, NX::Scheduler * scheduler):
-      std::vector<NX::AbstractTask*>(std::move(tasks)), myScheduler(scheduler), myFinished(nullptr) { attach(); }
+      std::vector<NX::AbstractTask*>(std::move(tasks)), myScheduler(scheduler), myState(nullptr) { attach(); }
     TaskGroup(std::vector<NX::AbstractTask*> && tasks, NX::Scheduler * scheduler):
-      std::vector<NX::AbstractTask*>(tasks), myScheduler(scheduler), myFinished(nullptr) { attach(); }
+      std::vector<NX::AbstractTask*>(tasks), myScheduler(scheduler), myState(nullptr) { attach(); }
 
     TaskGroup(NX::TaskGroup && other):
-      std::vector<NX::AbstractTask*>(other), myScheduler(other.myScheduler), myFinished(other.myFinished)
+      std::vector<NX::AbstractTask*>(other), myScheduler(other.myScheduler), myState(other.myState)
     {
     }
 
@@ -196,7 +443,7 @@ namespace NX
     }
 
     void attach() {
-      myFinished = std::make_shared<std::atomic_size_t>(0);
+      myState = std::make_shared<State>();
       for (auto task : *this) {
         attach(task);
       }
@@ -205,23 +452,58 @@ namespace NX
     void attach(NX::AbstractTask * task) {
       auto status = task->status();
       if (status == NX::AbstractTask::Status::FINISHED || status == NX::AbstractTask::Status::ABORTED)
-        (*myFinished)++;
+        myState->finish();
       else {
-        std::shared_ptr<std::atomic_size_t> finished(myFinished);
-        task->addCompletionHandler([finished] { (*finished)++; });
-        task->addCancellationHandler([finished] { (*finished)++; });
+        std::shared_ptr<State> state(myState);
+        task->addCompletionHandler([state] { state->finish(); });
+        task->addCancellationHandler([state] { state->finish(); });
       }
     }
 
     void await() {
-      while (*myFinished < size())
-        myScheduler->yield();
+      std::shared_ptr<State> state(myState);
+      std::size_t count = size();
+      {
+        boost::mutex::scoped_lock guard(state->lock);
+        if (state->finished >= count)
+          return;
+      }
+      // the last task to finish resumes us; if that already happened by the time we're armed, we don't wait at all
+      myScheduler->suspend([state, count](const NX::Scheduler::CompletionHandler & resume) {
+        {
+          boost::mutex::scoped_lock guard(state->lock);
+          if (state->finished < count) {
+            state->awaited = count;
+            state->waiter = resume;
+            return;
+          }
+        }
+        resume();
+      });
     }
 
   private:
     NX::Scheduler * myScheduler;
-    std::shared_ptr<std::atomic_size_t> myFinished;
+    std::shared_ptr<State> myState;
   };
 }
 
+template <typename Handler>
+NX::Task * NX::Scheduler::scheduleTask(Handler && handler, Priority priority)
+{
+  auto * task = new NX::Task(std::forward<Handler>(handler), this);
+  task->setPriority(priority);
+  scheduleAbstractTask(task);
+  return task;
+}
+
+template <typename Handler>
+NX::CoroutineTask * NX::Scheduler::scheduleCoroutine(Handler && handler, Priority priority)
+{
+  auto * task = new NX::CoroutineTask(std::forward<Handler>(handler), this);
+  task->setPriority(priority);
+  scheduleAbstractTask(task);
+  return task;
+}
+
 #endif // TASK_H
@@ -0,0 +1,133 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <boost/noncopyable.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace NX
+{
+  class AbstractTask;
+
+  /**
+   * Hierarchical timer wheel. Time is measured in ticks (the scheduler uses one tick per millisecond).
+   * Level 0 has one slot per tick, each level above it covers 64 times the span of the one below,
+   * and timers cascade down a level as their slot comes up. Insertion and removal are O(1), and
+   * finding the next expiry only looks at one occupancy word per level.
+   *
+   * Timers are addressed by an id that packs a slot index with a generation counter, so an id
+   * that outlived its timer (fired, or cancelled) is simply not found instead of hitting a reused slot.
+   *
+   * The wheel does no locking of its own.
+   */
+  class TimerWheel: public boost::noncopyable {
+  public:
+    typedef std::uint64_t Id;
+    typedef std::uint64_t Tick;
+    typedef std::function<void(void)> Handler;
+
+    static constexpr Tick NoTick = ~Tick(0);
+
+    /**
+     * What advance() hands back for every timer that came due: one-shot timers give up their task,
+     * periodic timers stay in the wheel and yield a copy of their handler instead.
+     */
+    struct Expired {
+      NX::AbstractTask * task;
+      Handler handler;
+    };
+
+  public:
+    explicit TimerWheel(Tick now = 0);
+
+    /**
+     * Adds a one-shot timer that releases the task at the given tick.
+     */
+    Id add(Tick expiry, NX::AbstractTask * task);
+
+    /**
+     * Adds a periodic timer. Every following expiry is computed from the previous deadline rather than
+     * from the time it was processed, so the period doesn't drift; missed periods are skipped, not replayed.
+     */
+    Id add(Tick expiry, Tick period, const Handler & handler);
+
+    /**
+     * Removes a timer. Returns false if the id doesn't refer to a live timer.
+     * For one-shot timers, the task it held is handed back through 'task'.
+     */
+    bool remove(Id id, NX::AbstractTask ** task = nullptr);
+
+    bool contains(Id id) const;
+
+    /**
+     * Moves the wheel forward to 'now', appending every timer that expired on the way.
+     */
+    void advance(Tick now, std::vector<Expired> & expired);
+
+    /**
+     * The next tick at which advance() has work to do (either an expiry or a cascade), or NoTick if empty.
+     */
+    Tick next() const;
+
+    Tick now() const { return myCurrent; }
+    std::size_t size() const { return mySize; }
+    bool empty() const { return !mySize; }
+
+  private:
+    static constexpr unsigned SlotBits = 6;
+    static constexpr unsigned SlotCount = 1u << SlotBits;
+    static constexpr unsigned LevelCount = 6;
+    static constexpr unsigned IndexBits = 24;
+    static constexpr unsigned GenerationBits = 29; // ids have to survive a round-trip through a JavaScript number
+    static constexpr std::uint32_t None = ~std::uint32_t(0);
+
+    struct Timer {
+      Tick expiry;
+      Tick period;
+      NX::AbstractTask * task;
+      Handler handler;
+      std::uint32_t generation;
+      std::uint32_t slot;
+      std::uint32_t prev, next;
+    };
+
+    Id insert(Tick expiry, Tick period, NX::AbstractTask * task, const Handler & handler);
+    std::uint32_t allocate();
+    void release(std::uint32_t index);
+    void link(std::uint32_t index);
+    void unlink(std::uint32_t index);
+    std::uint32_t detachSlot(std::uint32_t slot);
+    Timer * find(Id id);
+
+  private:
+    std::vector<Timer> myTimers;
+    std::vector<std::uint32_t> myFreeList;
+    std::uint32_t mySlots[LevelCount * SlotCount];
+    std::uint64_t myOccupied[LevelCount];
+    Tick myCurrent;
+    std::size_t mySize;
+  };
+}
+
+#endif // TIMER_WHEEL_H
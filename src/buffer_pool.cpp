@@ -0,0 +1,170 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "nexus.h"
+#include "buffer_pool.h"
+
+#include <wtf/FastMalloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+  constexpr unsigned MinClassBits = 10, MaxClassBits = 23;
+  constexpr unsigned ClassCount = MaxClassBits - MinClassBits + 1;
+  // how many bytes a thread, and the shared cache, may hold on to across all size classes; anything
+  // beyond that goes back to fastMalloc, so an idle pool costs at most this much
+  constexpr std::size_t ThreadBytes = 4 * 1024 * 1024;
+  constexpr std::size_t SharedBytes = 32 * 1024 * 1024;
+  // and how many buffers of one class, so small ones can't crowd out the rest
+  constexpr std::size_t MaxDepth = 64;
+
+  std::atomic_size_t bufferHits(0), bufferMisses(0);
+
+  boost::mutex sharedLock;
+  std::vector<void*> sharedBuffers[ClassCount];
+  std::size_t sharedBytes = 0;
+
+  // ClassCount for sizes that aren't pooled
+  unsigned sizeClass(std::size_t size) {
+    if (size <= (std::size_t(1) << MinClassBits))
+      return 0;
+    unsigned bits = 64 - __builtin_clzll(size - 1);
+    return bits > MaxClassBits ? ClassCount : bits - MinClassBits;
+  }
+
+  std::size_t classSize(unsigned index) {
+    return std::size_t(1) << (index + MinClassBits);
+  }
+
+  struct ThreadBuffers {
+    std::vector<void*> buffers[ClassCount];
+    std::size_t bytes = 0;
+    ~ThreadBuffers();
+  };
+
+  // ArrayBuffers can still be collected during thread teardown, after the cache itself is gone
+  thread_local bool threadBuffersDestroyed = false;
+  thread_local ThreadBuffers threadBuffers;
+
+  ThreadBuffers::~ThreadBuffers() {
+    threadBuffersDestroyed = true;
+    for(auto & buffers : this->buffers)
+      for(auto buffer : buffers)
+        WTF::fastFree(buffer);
+  }
+}
+
+std::size_t NX::BufferPool::capacity(std::size_t size)
+{
+  unsigned index = sizeClass(size);
+  return index < ClassCount ? classSize(index) : size;
+}
+
+char * NX::BufferPool::allocate(std::size_t size)
+{
+  unsigned index = sizeClass(size);
+  if (index >= ClassCount) {
+    bufferMisses.fetch_add(1, std::memory_order_relaxed);
+    return static_cast<char*>(WTF::fastMalloc(size));
+  }
+  void * buffer = nullptr;
+  if (!threadBuffersDestroyed && !threadBuffers.buffers[index].empty()) {
+    buffer = threadBuffers.buffers[index].back();
+    threadBuffers.buffers[index].pop_back();
+    threadBuffers.bytes -= classSize(index);
+  } else {
+    boost::mutex::scoped_lock lock(sharedLock);
+    if (!sharedBuffers[index].empty()) {
+      buffer = sharedBuffers[index].back();
+      sharedBuffers[index].pop_back();
+      sharedBytes -= classSize(index);
+    }
+  }
+  if (buffer) {
+    bufferHits.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    bufferMisses.fetch_add(1, std::memory_order_relaxed);
+    buffer = WTF::fastMalloc(capacity(size));
+  }
+  return static_cast<char*>(buffer);
+}
+
+void NX::BufferPool::deallocate(void * buffer, std::size_t size)
+{
+  unsigned index = sizeClass(size);
+  if (index >= ClassCount) {
+    WTF::fastFree(buffer);
+    return;
+  }
+  std::size_t bytes = classSize(index);
+  if (!threadBuffersDestroyed && threadBuffers.bytes + bytes <= ThreadBytes &&
+      threadBuffers.buffers[index].size() < MaxDepth) {
+    threadBuffers.buffers[index].push_back(buffer);
+    threadBuffers.bytes += bytes;
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(sharedLock);
+    if (sharedBytes + bytes <= SharedBytes && sharedBuffers[index].size() < MaxDepth) {
+      sharedBuffers[index].push_back(buffer);
+      sharedBytes += bytes;
+      return;
+    }
+  }
+  WTF::fastFree(buffer);
+}
+
+JSObjectRef NX::BufferPool::makeArrayBuffer(JSContextRef ctx, char * buffer, std::size_t size, std::size_t length,
+                                            JSValueRef * exception)
+{
+  size = capacity(size);
+  if (length < size / 4 && capacity(length) < size) {
+    char * smaller = allocate(length);
+    std::memcpy(smaller, buffer, length);
+    deallocate(buffer, size);
+    buffer = smaller;
+    size = capacity(length);
+  }
+  JSValueRef exp = nullptr;
+  // the size class travels in the deallocator context, so there's nothing to allocate or free alongside the buffer
+  JSObjectRef arrayBuffer = JSObjectMakeArrayBufferWithBytesNoCopy(ctx, buffer, length, [](void * bytes, void * size) {
+    NX::BufferPool::deallocate(bytes, reinterpret_cast<std::uintptr_t>(size));
+  }, reinterpret_cast<void*>(std::uintptr_t(size)), &exp);
+  if (exp) {
+    deallocate(buffer, size);
+    if (exception)
+      *exception = exp;
+    return nullptr;
+  }
+  return arrayBuffer;
+}
+
+std::size_t NX::BufferPool::hits()
+{
+  return bufferHits;
+}
+
+std::size_t NX::BufferPool::misses()
+{
+  return bufferMisses;
+}
@@ -17,19 +17,23 @@
  *
  */
 
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 
+#include <boost/thread/shared_mutex.hpp>
+
 #include "classes/emitter.h"
 #include "context.h"
 #include "globals/promise.h"
 #include "util.h"
 #include "nexus.h"
 
-const JSClassDefinition NX::Classes::Emitter::EventCallbackClass {
-  0, kJSClassAttributeNone, "EventCallback", nullptr, nullptr, nullptr, nullptr, [](JSObjectRef thisObject) {
-    delete reinterpret_cast<EventCallback*>(JSObjectGetPrivate(thisObject));
-  }
-};
+namespace {
+  boost::shared_mutex atomsLock;
+  std::unordered_map<std::string, NX::Classes::Emitter::EventId> atoms;
+}
 
 JSClassRef NX::Classes::Emitter::createClass (NX::Context * context)
 {
@@ -56,130 +60,273 @@ JSObjectRef NX::Classes::Emitter::getConstructor (NX::Context * context)
   return JSObjectMakeConstructor(context->toJSContext(), createClass(context), NX::Classes::Emitter::Constructor);
 }
 
+NX::Classes::Emitter::EventId NX::Classes::Emitter::intern (const std::string & name)
+{
+  EventId id = find(name);
+  if (id != NoEvent)
+    return id;
+  boost::unique_lock<boost::shared_mutex> writeLock(atomsLock);
+  return atoms.emplace(name, EventId(atoms.size())).first->second;
+}
+
+NX::Classes::Emitter::EventId NX::Classes::Emitter::find (const std::string & name)
+{
+  boost::shared_lock<boost::shared_mutex> readLock(atomsLock);
+  auto atom = atoms.find(name);
+  return atom != atoms.end() ? atom->second : NoEvent;
+}
+
+NX::Classes::Emitter::~Emitter()
+{
+  release(myTable.load());
+}
+
+NX::Classes::Emitter::Table * NX::Classes::Emitter::acquire()
+{
+  for(;;) {
+    unsigned epoch = myEpoch.load();
+    myReaders[epoch & 1]++;
+    // a writer that moved the epoch on in the meantime may not be waiting for us, try again
+    if (myEpoch.load() == epoch) {
+      Table * table = myTable.load();
+      if (table)
+        table->references++;
+      myReaders[epoch & 1]--;
+      return table;
+    }
+    myReaders[epoch & 1]--;
+  }
+}
+
+void NX::Classes::Emitter::release(Table * table)
+{
+  if (table && !--table->references)
+    delete table;
+}
+
+void NX::Classes::Emitter::update(const std::function<void(std::vector<Slot> &)> & change)
+{
+  Table * current = nullptr;
+  {
+    // nothing in here may call into JavaScript: whoever holds the VM lock may be waiting for this one
+    std::lock_guard<std::mutex> lock(myWriteLock);
+    current = myTable.load();
+    std::vector<Slot> slots;
+    if (current)
+      slots = current->slots;
+    change(slots);
+    myTable.store(slots.empty() ? nullptr : new Table(std::move(slots)));
+    // wait out the readers that may have seen the old table but not yet taken their reference on it
+    unsigned epoch = myEpoch++;
+    while (myReaders[epoch & 1].load())
+      std::this_thread::yield();
+  }
+  // dropping the last reference to a listener unprotects its function, which does take the VM lock
+  release(current);
+}
+
 JSValueRef NX::Classes::Emitter::addManyListener (JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, JSObjectRef callback, int count)
 {
-  JSC::JSLockHolder lock(toJS(ctx));
-  myMap[e].emplace_back(std::make_shared<Event>(e, NX::Object(ctx, callback), count));
+  return addManyListener(ctx, thisObject, intern(e), callback, count);
+}
+
+JSValueRef NX::Classes::Emitter::addManyListener (JSGlobalContextRef ctx, JSObjectRef thisObject, EventId e, JSObjectRef callback, int count)
+{
+  auto event = std::make_shared<Event>(e, NX::Object(ctx, callback), count);
+  update([&](std::vector<Slot> & slots) { slots.push_back(Slot { e, std::move(event) }); });
   return JSValueMakeUndefined(ctx);
 }
 
-JSValueRef NX::Classes::Emitter::addManyListener(JSGlobalContextRef ctx, JSObjectRef thisObject, const std::__cxx11::string & e, EventCallback callback, int count)
+JSValueRef NX::Classes::Emitter::addManyListener(JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, EventCallback callback, int count)
 {
-  NX::Context * context = NX::Context::FromJsContext(ctx);
-  JSObjectRef thisObjectForBind = JSObjectMake(ctx,
-                                               context->nexus()->defineOrGetClass(NX::Classes::Emitter::EventCallbackClass),
-                                               new EventCallback(std::move(callback)));
-  JSObjectRef jsCallback = JSBindFunction(ctx, JSObjectMakeFunctionWithCallback(ctx, ScopedString("addManyListenersCallback"),
-    [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount,
-       const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
-      NX::Context * context = NX::Context::FromJsContext(ctx);
-      auto cn = reinterpret_cast<EventCallback*>(JSObjectGetPrivate(thisObject));
-      try {
-        return cn->operator()(context->toJSContext(), argumentCount, arguments, exception);
-      } catch(const std::exception & e) {
-        return JSWrapException(context->toJSContext(), e, exception);
-      }
-      return JSValueMakeUndefined(ctx);
-    }), thisObjectForBind, 0, nullptr, nullptr);
-  return addManyListener(ctx, thisObject, e, jsCallback, count);
+  EventId id = intern(e);
+  auto event = std::make_shared<Event>(id, std::move(callback), count);
+  update([&](std::vector<Slot> & slots) { slots.push_back(Slot { id, std::move(event) }); });
+  return JSValueMakeUndefined(ctx);
+}
+
+JSValueRef NX::Classes::Emitter::Event::call(JSContextRef ctx, std::size_t argumentCount, const JSValueRef arguments[],
+                                             JSValueRef * exception) const
+{
+  // the C API takes the VM lock by itself, native listeners don't need it at all
+  if (!callback)
+    return JSObjectCallAsFunction(ctx, handler, nullptr, argumentCount, arguments, exception);
+  try {
+    return callback(ctx, argumentCount, arguments, exception);
+  } catch(const std::exception & e) {
+    return JSWrapException(ctx, e, exception);
+  }
 }
 
 JSObjectRef NX::Classes::Emitter::emit (JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, std::size_t
                                         argumentCount, const JSValueRef arguments[], JSValueRef * exception)
 {
-  JSC::JSLockHolder lock(toJS(ctx));
-  auto item = myMap.find(e);
-  if (item != myMap.end()) {
-    ProtectedArguments args(ctx, argumentCount, arguments);
-    std::vector<JSValueRef> promises;
-    for(auto & i: item->second)
-    {
-      JSValueProtect(ctx, thisObject);
-      if (i->count > 0)
-        i->count--;
-      NX::Object func(i->handler);
-      promises.emplace_back(NX::Globals::Promise::createPromise(ctx,
-        [=](JSContextRef ctx, ResolveRejectHandler resolve, ResolveRejectHandler reject) {
-          NX::Object funcCopy(func);
-          JSValueRef exp = nullptr;
-          JSValueRef val = funcCopy.call(nullptr, args, &exp);
-          if (exp)
-            reject(ctx, exp);
-          else
-            resolve(ctx, val);
-          JSValueUnprotect(ctx, thisObject);
-        }));
-    }
-    tidy(ctx, e);
-    return NX::Globals::Promise::all(ctx, promises);
-  } else {
-    std::vector<JSValueRef> emptyArrayValues;
-    NX::Object emptyArray(ctx, emptyArrayValues);
-    return NX::Globals::Promise::resolve(ctx, emptyArray);
+  return emit(ctx, thisObject, find(e), argumentCount, arguments, exception);
+}
+
+JSObjectRef NX::Classes::Emitter::emit (JSGlobalContextRef ctx, JSObjectRef thisObject, EventId e, std::size_t
+                                        argumentCount, const JSValueRef arguments[], JSValueRef * exception)
+{
+  NX::Context * context = NX::Context::FromJsContext(ctx);
+  std::vector<JSValueRef> promises;
+  std::shared_ptr<ProtectedArguments> args;
+  bool expired = false, last = false;
+  Table * table = acquire();
+  for(std::size_t i = 0; table && i < table->slots.size(); i++)
+  {
+    if (table->slots[i].id != e)
+      continue;
+    std::shared_ptr<Event> event = table->slots[i].event;
+    if (!event->claim(last))
+      continue;
+    expired |= last;
+    if (!args)
+      args = std::make_shared<ProtectedArguments>(ctx, argumentCount, arguments);
+    JSValueProtect(ctx, thisObject);
+    promises.emplace_back(NX::Globals::Promise::createPromise(ctx,
+      [=](JSContextRef ctx, ResolveRejectHandler resolve, ResolveRejectHandler reject) {
+        JSValueRef exp = nullptr;
+        JSValueRef val = event->call(ctx, args->size(), *args, &exp);
+        if (exp)
+          reject(ctx, exp);
+        else
+          resolve(ctx, val);
+        JSValueUnprotect(ctx, thisObject);
+      }));
+    context->nexus()->scheduler()->checkpoint();
   }
+  release(table);
+  if (expired)
+    tidy(ctx);
+  return NX::Globals::Promise::all(ctx, promises);
 }
 
+JSObjectRef NX::Classes::Emitter::emitInline (JSContextRef ctx, JSObjectRef thisObject, EventId e,
+                                              std::size_t argumentCount, const JSValueRef arguments[])
+{
+  NX::Context * context = NX::Context::FromJsContext(ctx);
+  std::vector<JSValueRef> pending;
+  JSValueRef error = nullptr;
+  bool expired = false, last = false;
+  Table * table = acquire();
+  for(std::size_t i = 0; table && i < table->slots.size(); i++)
+  {
+    const Slot & slot = table->slots[i];
+    if (slot.id != e || !slot.event->claim(last))
+      continue;
+    expired |= last;
+    JSValueRef exp = nullptr;
+    JSValueRef result = slot.event->call(context->toJSContext(), argumentCount, arguments, &exp);
+    if (exp) {
+      if (!error)
+        error = exp;
+    } else if (JSObjectRef promise = NX::Globals::Promise::fromThenable(context->toJSContext(), result)) {
+      pending.push_back(promise);
+    }
+    context->nexus()->scheduler()->checkpoint();
+  }
+  release(table);
+  if (expired)
+    tidy(ctx);
+  if (error)
+    return NX::Globals::Promise::reject(context->toJSContext(), error);
+  if (pending.empty())
+    return NX::Globals::Promise::resolved(context->toJSContext());
+  return NX::Globals::Promise::all(context->toJSContext(), pending);
+}
 
 void NX::Classes::Emitter::emitFast (JSContextRef ctx, JSObjectRef thisObject, const std::string & e, std::size_t
                                      argumentCount, const JSValueRef arguments[], JSValueRef * exception)
 {
-  JSC::JSLockHolder lock(toJS(ctx));
-  auto item = myMap.find(e);
-  if (item != myMap.end()) {
-    for(const auto &i: item->second)
-    {
-      if (i->count > 0)
-        i->count--;
-      i->handler.call(nullptr, std::vector<JSValueRef>(arguments, arguments + argumentCount), exception);
-    }
-    tidy(ctx, e);
+  emitFast(ctx, thisObject, find(e), argumentCount, arguments, exception);
+}
+
+void NX::Classes::Emitter::emitFast (JSContextRef ctx, JSObjectRef thisObject, EventId e, std::size_t
+                                     argumentCount, const JSValueRef arguments[], JSValueRef * exception)
+{
+  NX::Context * context = NX::Context::FromJsContext(ctx);
+  bool expired = false, last = false;
+  // listeners added or removed while we're at it take effect from the next emit on
+  Table * table = acquire();
+  for(std::size_t i = 0; table && i < table->slots.size(); i++)
+  {
+    const Slot & slot = table->slots[i];
+    if (slot.id != e || !slot.event->claim(last))
+      continue;
+    expired |= last;
+    slot.event->call(context->toJSContext(), argumentCount, arguments, exception);
+    context->nexus()->scheduler()->checkpoint();
   }
+  release(table);
+  if (expired)
+    tidy(ctx);
 }
 
 NX::TaskGroup NX::Classes::Emitter::emitFastAndSchedule(JSContextRef ctx, JSObjectRef thisObject, const std::string & e,
                                                std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception)
+{
+  return emitFastAndSchedule(ctx, thisObject, find(e), argumentCount, arguments, exception);
+}
+
+NX::TaskGroup NX::Classes::Emitter::emitFastAndSchedule(JSContextRef ctx, JSObjectRef thisObject, EventId e,
+                                               std::size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception)
 {
   NX::Context * context = NX::Context::FromJsContext(ctx);
-  JSC::JSLockHolder lock(toJS(ctx));
   NX::TaskGroup tasks(context->nexus()->scheduler());
-  auto item = myMap.find(e);
-  if (item != myMap.end()) {
-    for(const auto &i: item->second)
-    {
-      if (i->count > 0)
-        i->count--;
-      ProtectedArguments args(context->toJSContext(), argumentCount, arguments);
-      NX::Object func(i->handler);
-      auto task = context->nexus()->scheduler()->scheduleTask([=]() {
-        JSValueRef exp = nullptr;
-        func.call(nullptr, args, &exp);
-        if (exp)
-          NX::Nexus::ReportException(context->toJSContext(), exp);
-      });
-      tasks.emplace_back(task);
-    }
-    tidy(ctx, e);
+  std::vector<NX::Scheduler::CompletionHandler> handlers;
+  // one protected copy of the arguments, shared by every listener's task
+  std::shared_ptr<ProtectedArguments> args;
+  bool expired = false, last = false;
+  Table * table = acquire();
+  for(std::size_t i = 0; table && i < table->slots.size(); i++)
+  {
+    if (table->slots[i].id != e)
+      continue;
+    std::shared_ptr<Event> event = table->slots[i].event;
+    if (!event->claim(last))
+      continue;
+    expired |= last;
+    if (!args)
+      args = std::make_shared<ProtectedArguments>(context->toJSContext(), argumentCount, arguments);
+    handlers.push_back([=]() {
+      JSValueRef exp = nullptr;
+      event->call(context->toJSContext(), args->size(), *args, &exp);
+      if (exp)
+        NX::Nexus::ReportException(context->toJSContext(), exp);
+    });
   }
+  release(table);
+  if (!handlers.empty())
+    context->nexus()->scheduler()->scheduleBatch(std::move(handlers), &tasks);
+  if (expired)
+    tidy(ctx);
   return std::move(tasks);
 }
 
 
 JSValueRef NX::Classes::Emitter::removeAllListeners (JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e)
 {
-  JSC::JSLockHolder lock(toJS(ctx));
-  myMap.erase(e);
+  EventId id = find(e);
+  if (id == NoEvent)
+    return JSValueMakeUndefined(ctx);
+  update([&](std::vector<Slot> & slots) {
+    slots.erase(std::remove_if(slots.begin(), slots.end(), [&](const Slot & slot) {
+      return slot.id == id;
+    }), slots.end());
+  });
   return JSValueMakeUndefined(ctx);
 }
 
 JSValueRef NX::Classes::Emitter::removeListener (JSGlobalContextRef ctx, JSObjectRef thisObject, const std::string & e, JSObjectRef callback)
 {
-  JSC::JSLockHolder lock(toJS(ctx));
-  auto item = myMap.find(e);
-  if (item != myMap.end()) {
-    item->second.erase(std::remove_if(item->second.begin(), item->second.end(), [&](auto & event) {
-      return JSValueIsStrictEqual(ctx, callback, event->handler);
-    }), item->second.end());
-  }
+  EventId id = find(e);
+  if (id == NoEvent)
+    return JSValueMakeUndefined(ctx);
+  update([&](std::vector<Slot> & slots) {
+    slots.erase(std::remove_if(slots.begin(), slots.end(), [&](const Slot & slot) {
+      return slot.id == id && !slot.event->callback && JSObjectRef(slot.event->handler) == callback;
+    }), slots.end());
+  });
   return JSValueMakeUndefined(ctx);
 }
 
@@ -291,25 +438,30 @@ const JSStaticFunction NX::Classes::Emitter::Methods[] {
       }
     }, 0
   },
+  { "emitInline", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      try {
+        if (argumentCount < 1 || JSValueGetType(ctx, arguments[0]) != kJSTypeString)
+          throw NX::Exception("invalid arguments passed to EventEmitter.emitInline");
+        NX::Context * context = NX::Context::FromJsContext(ctx);
+        NX::Classes::Emitter * emitter = NX::Classes::Emitter::FromObject(thisObject);
+        if (!emitter)
+          throw NX::Exception("invalid Emitter instance");
+        return emitter->emitInline(context->toJSContext(), thisObject,
+                                   NX::Classes::Emitter::find(NX::Value(context->toJSContext(), arguments[0]).toString()),
+                                   argumentCount - 1, arguments + 1);
+      } catch(const std::exception & e) {
+        return JSWrapException(ctx, e, exception);
+      }
+    }, 0
+  },
   { nullptr, nullptr, 0 }
 };
 
-void NX::Classes::Emitter::tidy(JSContextRef ctx, const std::string &e) {
-  JSC::JSLockHolder lock(toJS(ctx));
-  auto item = myMap.find(e);
-  if (item != myMap.end()) {
-    auto & vec = item->second;
-    std::vector<std::vector<std::shared_ptr<NX::Classes::Emitter::Event>>::iterator> toRemove;
-    for(auto i = vec.begin(); i != vec.end();)
-    {
-      if ((*i)->count == 0) {
-        toRemove.push_back(i);
-      }
-      i++;
-    }
-    for(auto & i : toRemove)
-      vec.erase(i);
-    if (vec.empty())
-      myMap.erase(item);
-  }
+void NX::Classes::Emitter::tidy(JSContextRef ctx) {
+  update([](std::vector<Slot> & slots) {
+    slots.erase(std::remove_if(slots.begin(), slots.end(), [](const Slot & slot) {
+      return slot.event->count == 0;
+    }), slots.end());
+  });
 }
@@ -23,10 +23,12 @@
 #include "object.h"
 #include "context.h"
 #include "scheduler.h"
+#include "buffer_pool.h"
 #include "globals/promise.h"
 #include "classes/io/device.h"
 
 #include <boost/algorithm/string.hpp>
+#include <exception>
 #include <memory>
 
 JSClassRef NX::Classes::IO::Device::createClass (NX::Context * context)
@@ -205,17 +207,17 @@ JSStaticFunction NX::Classes::IO::Device::Methods[] {
   { "close", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
       size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef
     {
-      NX::Classes::IO::Device * dev = nullptr;
+      NX::PromiseHandle promise(ctx);
       try {
-        dev = NX::Classes::IO::Device::FromObject(thisObject);
-        if (!dev) {
-          return NX::Globals::Promise::reject(ctx, NX::Exception("Device does not implement close()").toError(ctx));
-        }
+        NX::Classes::IO::Device * dev = NX::Classes::IO::Device::FromObject(thisObject);
+        if (!dev)
+          throw NX::Exception("Device does not implement close()");
         dev->deviceClose();
-        return NX::Globals::Promise::resolve(ctx, thisObject);
+        promise.resolve(thisObject);
       } catch(const std::exception & e) {
-        return NX::Globals::Promise::reject(ctx, NX::Object(ctx, e));
+        promise.reject(e);
       }
+      return promise.promise();
     }, 0
   },
   { nullptr, nullptr, 0 }
@@ -320,54 +322,60 @@ JSStaticFunction NX::Classes::IO::PullSourceDevice::Methods[] {
       }
       JSValueProtect(context->toJSContext(), thisObject);
       NX::Scheduler * scheduler = context->nexus()->scheduler();
-      return NX::Globals::Promise::createPromise(ctx,
-        [=](JSContextRef ctx, ResolveRejectHandler resolve, ResolveRejectHandler reject)
-      {
-        NX::Context * context = NX::Context::FromJsContext(ctx);
-        auto readHandler = [=](auto readHandler, std::size_t readLength) {
-          char * buffer = nullptr;
-          try {
-            if (readLength == 0) {
-              if (auto seekable = dynamic_cast<NX::Classes::IO::SeekableSourceDevice*>(dev))
-                readLength = seekable->deviceBytesAvailable();
-              if (readLength == 0)
-                throw NX::Exception("must supply read length for non-seekable device");
-            }
-            buffer = (char *)WTF::fastMalloc(readLength);
-            if(!dev->deviceReady()) {
-              return reject(context->toJSContext(), NX::Exception("device not ready").toError(context->toJSContext()));
-            }
-            std::size_t readSoFar = dev->deviceRead(buffer, readLength);
-            if (readSoFar < readLength)
-              buffer = (char *)WTF::fastRealloc(buffer, readSoFar);
-            JSValueRef exp = nullptr;
-            JSObjectRef arrayBuffer = JSObjectMakeArrayBufferWithBytesNoCopy(context->toJSContext(), buffer, readSoFar,
-                                                                             [](void* bytes, void* deallocatorContext) {
-                                                                               WTF::fastFree(bytes);
-                                                                             }, nullptr, &exp);
-            if (exp)
-            {
-              reject(context->toJSContext(), exp);
-            } else {
-              resolve(context->toJSContext(), arrayBuffer);
-            }
-            JSValueUnprotect(context->toJSContext(), thisObject);
-          } catch (const std::exception & e) {
-            if (buffer)
-              WTF::fastFree(buffer);
-            JSValueRef exp = nullptr;
-            JSWrapException(context->toJSContext(), e, &exp);
-            reject(context->toJSContext(), exp);
-            JSValueUnprotect(context->toJSContext(), thisObject);
+      NX::PromiseHandle promise(ctx);
+      struct Read { char * buffer; std::size_t length, size; std::exception_ptr error; };
+      auto read = std::make_shared<Read>(Read { nullptr, length, 0, nullptr });
+      // the part that touches the device, which may block; nothing in here may call into JavaScript
+      auto fill = [=]() {
+        try {
+          std::size_t readLength = read->length;
+          if (readLength == 0) {
+            if (auto seekable = dynamic_cast<NX::Classes::IO::SeekableSourceDevice*>(dev))
+              readLength = seekable->deviceBytesAvailable();
+            if (readLength == 0)
+              throw NX::Exception("must supply read length for non-seekable device");
           }
-        };
-        scheduler->scheduleTask(std::bind(readHandler, readHandler, length));
-      });
+          if(!dev->deviceReady())
+            throw NX::Exception("device not ready");
+          read->size = readLength;
+          read->buffer = NX::BufferPool::allocate(readLength);
+          read->length = dev->deviceRead(read->buffer, readLength);
+        } catch (...) {
+          if (read->buffer)
+            NX::BufferPool::deallocate(read->buffer, read->size);
+          read->buffer = nullptr;
+          read->error = std::current_exception();
+        }
+      };
+      auto deliver = [=]() {
+        try {
+          if (read->error)
+            std::rethrow_exception(read->error);
+          JSValueRef exp = nullptr;
+          JSObjectRef arrayBuffer = NX::BufferPool::makeArrayBuffer(context->toJSContext(), read->buffer, read->size,
+                                                                    read->length, &exp);
+          if (exp)
+            promise.reject(exp);
+          else
+            promise.resolve(arrayBuffer);
+        } catch (const std::exception & e) {
+          JSValueRef exp = nullptr;
+          JSWrapException(context->toJSContext(), e, &exp);
+          promise.reject(exp);
+        }
+        JSValueUnprotect(context->toJSContext(), thisObject);
+      };
+      if (dev->deviceBlocking())
+        scheduler->scheduleBlocking(fill, deliver);
+      else
+        scheduler->scheduleTask([=]() { fill(); deliver(); });
+      return promise.promise();
     }, 0
   },
   { "readSync", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
     size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
       char * buffer = nullptr;
+      std::size_t length = 0;
       try {
 //        NX::Context * context = NX::Context::FromJsContext(ctx);
         NX::Classes::IO::PullSourceDevice * dev = NX::Classes::IO::PullSourceDevice::FromObject(thisObject);
@@ -378,20 +386,18 @@ JSStaticFunction NX::Classes::IO::PullSourceDevice::Methods[] {
             throw NX::Exception("bad value for length argument");
           }
         }
-        std::size_t length = static_cast<size_t>(NX::Value(ctx, arguments[0]).toNumber());
-        buffer = (char * )WTF::fastMalloc(length);
-        std::size_t readSoFar = 0;
+        length = static_cast<size_t>(NX::Value(ctx, arguments[0]).toNumber());
         if(!dev->deviceReady())
           throw NX::Exception("device not ready");
-        readSoFar = dev->deviceRead(buffer, length);
-        if (readSoFar != length)
-          buffer = (char *)WTF::fastRealloc(buffer, readSoFar);
-        JSObjectRef arrayBuffer = JSObjectMakeArrayBufferWithBytesNoCopy(ctx, buffer, readSoFar,
-                [](void* bytes, void* deallocatorContext) { WTF::fastFree(bytes); }, nullptr, exception);
-        return arrayBuffer;
+        buffer = NX::BufferPool::allocate(length);
+        std::size_t readSoFar = dev->deviceRead(buffer, length);
+        // the ArrayBuffer takes the buffer over from here on
+        char * filled = buffer;
+        buffer = nullptr;
+        return NX::BufferPool::makeArrayBuffer(ctx, filled, length, readSoFar, exception);
       } catch(const std::exception & e) {
         if (buffer)
-          WTF::fastFree(buffer);
+          NX::BufferPool::deallocate(buffer, length);
         return JSWrapException(ctx, e, exception);
       }
     }, 0
@@ -463,46 +469,60 @@ JSStaticFunction NX::Classes::IO::SinkDevice::Methods[] {
       if (exp)
         return NX::Globals::Promise::reject(ctx, exp);
       NX::Scheduler * scheduler = context->nexus()->scheduler();
-      return NX::Globals::Promise::createPromise(ctx,
-        [=](JSContextRef ctx, ResolveRejectHandler resolve, ResolveRejectHandler reject)
-      {
-        NX::Context * context = NX::Context::FromJsContext(ctx);
-        auto writeHandler = [=](auto writeHandler, std::size_t written) {
-          try {
-            while (written < length) {
-              if (!dev->deviceReady() && dev->deviceOpen()) {
-                if (auto ec = dev->deviceError()) {
-                  throw NX::Exception(ec);
-                }
-                scheduler->scheduleTask(std::bind<void>(writeHandler, writeHandler, written));
-                return;
-              }
+      NX::PromiseHandle promise(ctx);
+      auto writeHandler = [=](auto writeHandler, std::size_t written, std::exception_ptr error) {
+        try {
+          if (error)
+            std::rethrow_exception(error);
+          while (written < length) {
+            if (!dev->deviceReady() && dev->deviceOpen()) {
               if (auto ec = dev->deviceError()) {
                 throw NX::Exception(ec);
               }
-              else if (!dev->deviceOpen())
-                break;
-              auto max = dev->maxWriteBufferSize();
-              if (auto size = std::min(dev->recommendedWriteBufferSize(), std::size_t(length - written))) {
-                if (size > max) size = max;
-                written += dev->deviceWrite(buffer + written, size);
-                scheduler->scheduleTask(std::bind<void>(writeHandler, writeHandler, written));
-                return;
-              } else
-                break;
+              scheduler->scheduleTask(std::bind<void>(writeHandler, writeHandler, written, nullptr),
+                                      NX::Scheduler::INTERACTIVE);
+              return;
+            }
+            if (auto ec = dev->deviceError()) {
+              throw NX::Exception(ec);
             }
-          } catch (const std::exception & e) {
-            reject(context->toJSContext(), NX::Object(context->toJSContext(), e));
-            JSValueUnprotect(context->toJSContext(), arrayBuffer);
-            JSValueUnprotect(context->toJSContext(), thisObject);
-            return;
+            else if (!dev->deviceOpen())
+              break;
+            auto max = dev->maxWriteBufferSize();
+            if (auto size = std::min(dev->recommendedWriteBufferSize(), std::size_t(length - written))) {
+              if (size > max) size = max;
+              if (dev->deviceBlocking()) {
+                // the write itself goes to the blocking pool, and we pick up from here once it's done
+                auto progress = std::make_shared<std::pair<std::size_t, std::exception_ptr>>(written, nullptr);
+                scheduler->scheduleBlocking([=]() {
+                  try {
+                    progress->first += dev->deviceWrite(buffer + progress->first, size);
+                  } catch (...) {
+                    progress->second = std::current_exception();
+                  }
+                }, [=]() { writeHandler(writeHandler, progress->first, progress->second); }, NX::Scheduler::INTERACTIVE);
+                return;
+              }
+              written += dev->deviceWrite(buffer + written, size);
+              scheduler->scheduleTask(std::bind<void>(writeHandler, writeHandler, written, nullptr),
+                                      NX::Scheduler::INTERACTIVE);
+              return;
+            } else
+              break;
           }
-          resolve(context->toJSContext(), JSValueMakeNumber(context->toJSContext(), written));
+        } catch (const std::exception & e) {
+          promise.reject(e);
           JSValueUnprotect(context->toJSContext(), arrayBuffer);
           JSValueUnprotect(context->toJSContext(), thisObject);
-        };
-        scheduler->scheduleTask(std::bind(writeHandler, writeHandler, 0));
-      });
+          return;
+        }
+        promise.resolve(JSValueMakeNumber(context->toJSContext(), written));
+        JSValueUnprotect(context->toJSContext(), arrayBuffer);
+        JSValueUnprotect(context->toJSContext(), thisObject);
+      };
+      // writes are what a peer is waiting on, so they jump ahead of bulk work
+      scheduler->scheduleTask(std::bind(writeHandler, writeHandler, 0, nullptr), NX::Scheduler::INTERACTIVE);
+      return promise.promise();
     }, 0
   },
   { "writeSync", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
@@ -569,26 +589,23 @@ JSStaticFunction NX::Classes::IO::SeekableDevice::Methods[] {
       std::size_t offset = static_cast<size_t>(NX::Value (ctx, arguments[0]).toNumber());
       std::string position = NX::Value (ctx, arguments[1]).toString();
       NX::Classes::IO::SeekableDevice * dev = NX::Classes::IO::SeekableDevice::FromObject(thisObject);
-      return NX::Globals::Promise::createPromise(context->toJSContext(),
-        [=](JSContextRef ctx, ResolveRejectHandler resolve, ResolveRejectHandler reject)
-      {
-        NX::Context * context = NX::Context::FromJsContext(ctx);
-        try {
-          Device::Position pos = Beginning;
-          if (boost::iequals(position, "begin"))
-            pos = Beginning;
-          else if (boost::iequals(position, "current"))
-            pos = Current;
-          else if (boost::iequals(position, "end"))
-            pos = End;
-          if(!dev->deviceReady())
-            throw NX::Exception("device not ready");
-          std::size_t newOffset = dev->deviceSeek(offset, pos);
-          return resolve(ctx, NX::Value(context->toJSContext(), newOffset).value());
-        } catch (const std::exception & e) {
-          return reject(ctx, NX::Object(context->toJSContext(), e).value());
-        }
-      });
+      NX::PromiseHandle promise(ctx);
+      try {
+        Device::Position pos = Beginning;
+        if (boost::iequals(position, "begin"))
+          pos = Beginning;
+        else if (boost::iequals(position, "current"))
+          pos = Current;
+        else if (boost::iequals(position, "end"))
+          pos = End;
+        if(!dev->deviceReady())
+          throw NX::Exception("device not ready");
+        std::size_t newOffset = dev->deviceSeek(offset, pos);
+        promise.resolve(NX::Value(context->toJSContext(), newOffset).value());
+      } catch (const std::exception & e) {
+        promise.reject(e);
+      }
+      return promise.promise();
     }, 0
   },
   { "seekSync", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
@@ -653,25 +670,23 @@ JSStaticFunction NX::Classes::IO::DualSeekableDevice::Methods[] {
       std::size_t offset = static_cast<size_t>(NX::Value (ctx, arguments[0]).toNumber());
       std::string position = NX::Value (ctx, arguments[1]).toString();
       NX::Classes::IO::DualSeekableDevice * dev = NX::Classes::IO::DualSeekableDevice::FromObject(thisObject);
-      return NX::Globals::Promise::createPromise(context->toJSContext(),
-        [=](JSContextRef ctx, ResolveRejectHandler resolve, ResolveRejectHandler reject)
-      {
-        try {
-          Device::Position pos = Beginning;
-          if (boost::iequals(position, "begin"))
-            pos = Beginning;
-          else if (boost::iequals(position, "current"))
-            pos = Current;
-          else if (boost::iequals(position, "end"))
-            pos = End;
-          if(!dev->deviceReady())
-            throw NX::Exception("device not ready");
-          std::size_t newOffset = dev->deviceReadSeek(offset, pos);
-          return resolve(ctx, NX::Value(context->toJSContext(), newOffset).value());
-        } catch (const std::exception & e) {
-          return reject(ctx, NX::Object(context->toJSContext(), e).value());
-        }
-      });
+      NX::PromiseHandle promise(ctx);
+      try {
+        Device::Position pos = Beginning;
+        if (boost::iequals(position, "begin"))
+          pos = Beginning;
+        else if (boost::iequals(position, "current"))
+          pos = Current;
+        else if (boost::iequals(position, "end"))
+          pos = End;
+        if(!dev->deviceReady())
+          throw NX::Exception("device not ready");
+        std::size_t newOffset = dev->deviceReadSeek(offset, pos);
+        promise.resolve(NX::Value(context->toJSContext(), newOffset).value());
+      } catch (const std::exception & e) {
+        promise.reject(e);
+      }
+      return promise.promise();
     }, 0
   },
   { "writeSeek", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
@@ -697,25 +712,23 @@ JSStaticFunction NX::Classes::IO::DualSeekableDevice::Methods[] {
       std::size_t offset = static_cast<size_t>(NX::Value (ctx, arguments[0]).toNumber());
       std::string position = NX::Value (ctx, arguments[1]).toString();
       NX::Classes::IO::DualSeekableDevice * dev = NX::Classes::IO::DualSeekableDevice::FromObject(thisObject);
-      return NX::Globals::Promise::createPromise(context->toJSContext(),
-        [=](JSContextRef ctx, ResolveRejectHandler resolve, ResolveRejectHandler reject)
-      {
-        try {
-          Device::Position pos = Beginning;
-          if (boost::iequals(position, "begin"))
-            pos = Beginning;
-          else if (boost::iequals(position, "current"))
-            pos = Current;
-          else if (boost::iequals(position, "end"))
-            pos = End;
-          if(!dev->deviceReady())
-            throw NX::Exception("device not ready");
-          std::size_t newOffset = dev->deviceWriteSeek(offset, pos);
-          return resolve(ctx, NX::Value(context->toJSContext(), newOffset).value());
-        } catch (const std::exception & e) {
-          return reject(ctx, NX::Object(context->toJSContext(), e).value());
-        }
-      });
+      NX::PromiseHandle promise(ctx);
+      try {
+        Device::Position pos = Beginning;
+        if (boost::iequals(position, "begin"))
+          pos = Beginning;
+        else if (boost::iequals(position, "current"))
+          pos = Current;
+        else if (boost::iequals(position, "end"))
+          pos = End;
+        if(!dev->deviceReady())
+          throw NX::Exception("device not ready");
+        std::size_t newOffset = dev->deviceWriteSeek(offset, pos);
+        promise.resolve(NX::Value(context->toJSContext(), newOffset).value());
+      } catch (const std::exception & e) {
+        promise.reject(e);
+      }
+      return promise.promise();
     }, 0
   },
   { "readSeekSync", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
@@ -19,6 +19,7 @@
 
 #include "util.h"
 #include "nexus.h"
+#include "buffer_pool.h"
 #include "classes/io/device.h"
 #include "classes/io/devices/file.h"
 
@@ -149,83 +150,84 @@ JSObjectRef NX::Classes::IO::Devices::FilePushDevice::resume (JSContextRef ctx,
   if (myState == Paused)
   {
     NX::Context * context = NX::Context::FromJsContext (ctx);
-    if (!myStream.is_open()) {
-      myStream.open(myPath, std::ios_base::in | std::ios_base::binary);
-    }
     myState = Resumed;
     NX::Object thisObj(context->toJSContext(), thisObject);
-    myPromise = NX::Object(context->toJSContext(), NX::Globals::Promise::createPromise(context->toJSContext(),
-      [=](JSContextRef ctx, NX::ResolveRejectHandler resolve, NX::ResolveRejectHandler reject) -> JSValueRef
-      {
-        NX::Context * context = NX::Context::FromJsContext(ctx);
-        auto readHandler = [=](auto readHandler) {
-          if (myState == Resumed) {
-            try {
-              auto buffer = (char *) WTF::fastMalloc(FILE_PUSH_DEVICE_BUFFER_SIZE);
-              auto sizeOut = static_cast<size_t>(myStream.readsome(buffer, FILE_PUSH_DEVICE_BUFFER_SIZE));
-              if (!sizeOut) {
-                myStream.read(buffer, FILE_PUSH_DEVICE_BUFFER_SIZE);
-                sizeOut = static_cast<size_t>(myStream.gcount());
-              }
-              if (sizeOut) {
-                if (sizeOut < FILE_PUSH_DEVICE_BUFFER_SIZE)
-                  buffer = static_cast<char *>(WTF::fastRealloc(buffer, sizeOut));
-                JSValueRef exp = nullptr;
-                JSObjectRef arrayBuffer = JSObjectMakeArrayBufferWithBytesNoCopy(
-                  context->toJSContext(), buffer, sizeOut,
-                  [](void *ptr, void *) {
-                    WTF::fastFree(ptr);
-                  }, this, &exp);
-                if (exp) {
-                  myState = Paused;
-                  WTF::fastFree(buffer);
-                  reject(context->toJSContext(), exp);
-                  return;
-                }
-                JSValueRef args[]{arrayBuffer};
-                NX::Object(context->toJSContext(), this->emit(context->toJSContext(), thisObj, "data", 1, args, &exp))
-                  .then([=](JSContextRef ctx, JSValueRef arg, JSValueRef *exception) {
-                    if (!myStream.eof()) {
-                      myScheduler->scheduleTask(std::move(std::bind<void>(readHandler, readHandler)));
-                    } else {
-                      emitFast(context->toJSContext(), thisObj, "end", 0, nullptr, nullptr);
-                      resolve(ctx, thisObj);
-                    }
-                    return arg;
-                  }, [=](JSContextRef ctx, JSValueRef arg, JSValueRef *exception) {
-                    myState = Paused;
-                    JSValueRef args[] { arg };
-                    emitFast(context->toJSContext(), thisObj, "error", 1, args, nullptr);
-                    reject(ctx, arg);
-                    return arg;
-                  });
-                if (exp) {
-                  myState = Paused;
-                  JSValueRef args[] { exp };
-                  emitFast(context->toJSContext(), thisObj, "error", 1, args, nullptr);
-                  reject(context->toJSContext(), exp);
-                  return;
-                }
-              } else {
-                WTF::fastFree(buffer);
-                if (myStream.eof()) {
-                  myState = Paused;
-                  this->emitFast(context->toJSContext(), thisObj, "end", 0, nullptr, nullptr);
-                  resolve(context->toJSContext(), thisObj);
-                  return;
+    NX::PromiseHandle promise(ctx);
+    myPromise = NX::Object(context->toJSContext(), promise.promise());
+    static const EventId dataEvent = intern("data"), endEvent = intern("end");
+    struct Chunk { char * buffer; std::size_t length; std::exception_ptr error; };
+    // every chunk is read on the blocking pool, a read of up to 8 MB mustn't tie up a JavaScript thread,
+    // and handed back to a task to be emitted; the next read is only queued once that's done
+    auto readHandler = [=](auto readHandler) -> void {
+      if (myState != Resumed) {
+        myScheduler->scheduleTask(std::bind<void>(readHandler, readHandler), NX::Scheduler::BACKGROUND);
+        return;
+      }
+      auto chunk = std::make_shared<Chunk>(Chunk { nullptr, 0, nullptr });
+      myScheduler->scheduleBlocking([=]() {
+        try {
+          if (!myStream.is_open())
+            myStream.open(myPath, std::ios_base::in | std::ios_base::binary);
+          chunk->buffer = NX::BufferPool::allocate(FILE_PUSH_DEVICE_BUFFER_SIZE);
+          chunk->length = static_cast<size_t>(myStream.readsome(chunk->buffer, FILE_PUSH_DEVICE_BUFFER_SIZE));
+          if (!chunk->length) {
+            myStream.read(chunk->buffer, FILE_PUSH_DEVICE_BUFFER_SIZE);
+            chunk->length = static_cast<size_t>(myStream.gcount());
+          }
+        } catch(...) {
+          chunk->error = std::current_exception();
+        }
+      }, [=]() {
+        JSContextRef ctx = context->toJSContext();
+        try {
+          if (chunk->error) {
+            if (chunk->buffer)
+              NX::BufferPool::deallocate(chunk->buffer, FILE_PUSH_DEVICE_BUFFER_SIZE);
+            std::rethrow_exception(chunk->error);
+          }
+          if (chunk->length) {
+            JSValueRef exp = nullptr;
+            JSObjectRef arrayBuffer = NX::BufferPool::makeArrayBuffer(ctx, chunk->buffer, FILE_PUSH_DEVICE_BUFFER_SIZE,
+                                                                      chunk->length, &exp);
+            if (exp) {
+              myState = Paused;
+              promise.reject(exp);
+              return;
+            }
+            JSValueRef args[]{arrayBuffer};
+            NX::Object(ctx, this->emitInline(ctx, thisObj, dataEvent, 1, args))
+              .then([=](JSContextRef ctx, JSValueRef arg, JSValueRef *exception) {
+                if (!myStream.eof()) {
+                  readHandler(readHandler);
                 } else {
-                  myScheduler->scheduleTask(std::move(std::bind<void>(readHandler, readHandler)));
+                  emitFast(context->toJSContext(), thisObj, endEvent, 0, nullptr, nullptr);
+                  promise.resolve(thisObj);
                 }
-              }
-            } catch(const std::exception &e) {
-              reject(context->toJSContext(), NX::Object(context->toJSContext(), e));
+                return arg;
+              }, [=](JSContextRef ctx, JSValueRef arg, JSValueRef *exception) {
+                myState = Paused;
+                JSValueRef args[] { arg };
+                emitFast(context->toJSContext(), thisObj, "error", 1, args, nullptr);
+                promise.reject(arg);
+                return arg;
+              });
+          } else {
+            NX::BufferPool::deallocate(chunk->buffer, FILE_PUSH_DEVICE_BUFFER_SIZE);
+            if (myStream.eof()) {
+              myState = Paused;
+              this->emitFast(ctx, thisObj, endEvent, 0, nullptr, nullptr);
+              promise.resolve(thisObj);
+            } else {
+              readHandler(readHandler);
             }
-          } else
-            myScheduler->scheduleTask(std::bind<void>(readHandler, readHandler));
-        };
-        myScheduler->scheduleTask(std::bind(readHandler, readHandler));
-        return JSValueMakeUndefined(ctx);
-    }));
+          }
+        } catch(const std::exception &e) {
+          promise.reject(e);
+        }
+      }, NX::Scheduler::BACKGROUND);
+    };
+    // bulk reads: under load they give way to socket and response work
+    readHandler(readHandler);
   }
   return myPromise;
 }
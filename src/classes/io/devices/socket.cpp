@@ -17,6 +17,7 @@
  *
  */
 
+#include "buffer_pool.h"
 #include "globals/promise.h"
 #include "classes/io/devices/socket.h"
 #include <boost/asio/ip/basic_resolver_iterator.hpp>
@@ -297,7 +298,7 @@ JSObjectRef NX::Classes::IO::Devices::UDPSocket::resume (JSContextRef ctx, JSObj
     auto recvHandler = [=](auto next, char * buffer, std::size_t len, const std::shared_ptr<Endpoint> & endpoint,
                            const boost::system::error_code& ec, std::size_t bytes_transferred) -> void {
       if (ec) {
-        if (buffer) WTF::fastFree(buffer);
+        if (buffer) NX::BufferPool::deallocate(buffer, len);
         reject(context->toJSContext(), NX::Object(context->toJSContext(), ec));
         JSValueUnprotect(context->toJSContext(), thisObject);
         myScheduler->release();
@@ -307,15 +308,14 @@ JSObjectRef NX::Classes::IO::Devices::UDPSocket::resume (JSContextRef ctx, JSObj
       {
         if (buffer) {
           if (bytes_transferred) {
-            JSObjectRef arrayBuffer = JSObjectMakeArrayBufferWithBytesNoCopy(context->toJSContext(), buffer, bytes_transferred, [](void * ptr, void * ctx) {
-              WTF::fastFree(ptr);
-            }, nullptr, nullptr);
+            JSObjectRef arrayBuffer = NX::BufferPool::makeArrayBuffer(context->toJSContext(), buffer, len, bytes_transferred, nullptr);
             NX::Object endpointData(context->toJSContext());
             endpointData.set("address", NX::Value(context->toJSContext(), endpoint->address().to_string()).value());
             endpointData.set("port", NX::Value(context->toJSContext(), endpoint->port()).value());
             JSValueRef args[] { arrayBuffer, endpointData };
             JSValueRef exp = nullptr;
-            this->emitFast(context->toJSContext(), thisObject, "data", 2, args, &exp);
+            static const EventId dataEvent = intern("data");
+            this->emitFast(context->toJSContext(), thisObject, dataEvent, 2, args, &exp);
             if (exp) {
               reject(context->toJSContext(), exp);
               JSValueUnprotect(context->toJSContext(), thisObject);
@@ -323,14 +323,14 @@ JSObjectRef NX::Classes::IO::Devices::UDPSocket::resume (JSContextRef ctx, JSObj
               return;
             }
           } else {
-            WTF::fastFree(buffer);
+            NX::BufferPool::deallocate(buffer, len);
             buffer = nullptr;
           }
         }
         if (mySocket->is_open() && myState == Resumed) {
-          std::size_t bufSize = mySocket->available();
-          if (!bufSize) bufSize = 1024;
-          char * buf = (char *)WTF::fastMalloc(bufSize);
+          // receive into the whole pooled buffer, not just what's available right now
+          std::size_t bufSize = NX::BufferPool::capacity(std::max<std::size_t>(mySocket->available(), 1024));
+          char * buf = NX::BufferPool::allocate(bufSize);
           std::shared_ptr<Endpoint> newEndpoint(new Endpoint());
           mySocket->async_receive_from(boost::asio::buffer(buf, bufSize), *newEndpoint,
             boost::bind<void>(next, next, buf, bufSize, newEndpoint, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
@@ -362,7 +362,7 @@ JSObjectRef NX::Classes::IO::Devices::TCPSocket::resume(JSContextRef ctx, JSObje
       NX::Scheduler::Holder holderCopy(holder);
       if (ec) {
         myState = Paused;
-        if (buffer) WTF::fastFree(buffer);
+        if (buffer) NX::BufferPool::deallocate(buffer, len);
         if (ec != boost::system::errc::operation_canceled) {
           JSValueRef args[] { NX::Object(context->toJSContext(), ec) };
           emitFastAndSchedule(context->toJSContext(), thisObj, "error", 1, args, nullptr);
@@ -378,14 +378,12 @@ JSObjectRef NX::Classes::IO::Devices::TCPSocket::resume(JSContextRef ctx, JSObje
       {
         if (buffer) {
           if (bytes_transferred) {
-            JSObjectRef arrayBuffer = JSObjectMakeArrayBufferWithBytesNoCopy(context->toJSContext(),
-                                                                             buffer, bytes_transferred,
-                                                                             [](void * ptr, void * ctx) {
-              WTF::fastFree(ptr);
-            }, nullptr, nullptr);
+            JSObjectRef arrayBuffer = NX::BufferPool::makeArrayBuffer(context->toJSContext(), buffer, len,
+                                                                      bytes_transferred, nullptr);
             JSValueRef args[] { arrayBuffer };
             JSValueRef exp = nullptr;
-            this->emitFastAndSchedule(context->toJSContext(), thisObj, "data", 1, args, &exp);
+            static const EventId dataEvent = intern("data");
+            this->emitFastAndSchedule(context->toJSContext(), thisObj, dataEvent, 1, args, &exp);
             if (exp) {
               JSValueRef args[] { exp };
               emitFastAndSchedule(context->toJSContext(), thisObj, "error", 1, args, nullptr);
@@ -396,19 +394,21 @@ JSObjectRef NX::Classes::IO::Devices::TCPSocket::resume(JSContextRef ctx, JSObje
               return;
             }
           } else {
-            WTF::fastFree(buffer);
+            NX::BufferPool::deallocate(buffer, len);
             buffer = nullptr;
           }
         }
         if (mySocket->is_open() && myState == Resumed) {
-          std::size_t bufSize = mySocket->available();
-          if (!bufSize) bufSize = 1024;
-          char * buf = (char *)WTF::fastMalloc(bufSize);
+          // receive into the whole pooled buffer, not just what's available right now
+          std::size_t bufSize = NX::BufferPool::capacity(std::max<std::size_t>(mySocket->available(), 1024));
+          char * buf = NX::BufferPool::allocate(bufSize);
           mySocket->async_receive(boost::asio::buffer(buf, bufSize),
                                   boost::bind<void>(next, next, buf, bufSize, boost::asio::placeholders::error,
                                       boost::asio::placeholders::bytes_transferred));
         } else if (mySocket->is_open()){
-          myScheduler->scheduleTask(boost::bind<void>(next, next, buffer, len, ec, bytes_transferred));
+          // the buffer went to the ArrayBuffer above; passing it on would emit it again and free it twice
+          myScheduler->scheduleTask(boost::bind<void>(next, next, nullptr, 0, ec, 0),
+                                    NX::Scheduler::INTERACTIVE);
           return;
         } else {
           resolve(context->toJSContext(), thisObj);
@@ -103,7 +103,8 @@ JSStaticFunction NX::Classes::IO::Filter::Methods[] {
               outBuffer = static_cast<char *>(WTF::fastRealloc(outBuffer, outLength));
               outPtr = outBuffer + remappedOutOffset;
               context->nexus()->scheduler()->scheduleTask(
-                std::bind<void>(handler, handler, inBuffer, inLength, outBuffer, outLength, outPtr, outRemaining)
+                std::bind<void>(handler, handler, inBuffer, inLength, outBuffer, outLength, outPtr, outRemaining),
+                NX::Scheduler::BACKGROUND
               );
               return;
             }
@@ -130,7 +131,8 @@ JSStaticFunction NX::Classes::IO::Filter::Methods[] {
         std::size_t originalEstimate = filter->estimateOutputLength(buffer, length);
         auto outBuffer = static_cast<char *>(WTF::fastMalloc(originalEstimate));
         scheduler->scheduleTask(std::bind(handler, handler, buffer, length,
-                                                    outBuffer, originalEstimate, outBuffer, originalEstimate));
+                                                    outBuffer, originalEstimate, outBuffer, originalEstimate),
+                                NX::Scheduler::BACKGROUND);
       };
       return NX::Globals::Promise::createPromise(ctx, executor);
     }, 0
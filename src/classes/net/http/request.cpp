@@ -67,6 +67,7 @@ JSValueRef NX::Classes::Net::HTTP::Request::attach(JSContextRef ctx, JSObjectRef
 //    };
 //    myParser->on_chunk_body(onChunkBody);
 //  }
+  static const EventId dataEvent = intern("data"), endEvent = intern("end");
   NX::Globals::Promise::Executor executor = [=](JSContextRef ctx, ResolveRejectHandler resolve,
                                                 ResolveRejectHandler reject) {
     myConnection->addListener(context->toJSContext(), connectionObj, "data",
@@ -123,11 +124,11 @@ JSValueRef NX::Classes::Net::HTTP::Request::attach(JSContextRef ctx, JSObjectRef
                                     }
                                   }
                                   if (myParser->is_done()) {
-                                    emitFast(context->toJSContext(), thisObj, "end", 0, nullptr, nullptr);
+                                    emitFast(context->toJSContext(), thisObj, endEvent, 0, nullptr, nullptr);
                                   } else {
                                     JSValueRef dataArgs[]{buffer};
                                     JSValueRef pException = nullptr;
-                                    emitFast(ctx, thisObj, "data", 1, dataArgs, &pException);
+                                    emitFast(ctx, thisObj, dataEvent, 1, dataArgs, &pException);
                                     if (pException) {
                                       reject(context->toJSContext(), pException);
                                     }
@@ -105,6 +105,8 @@ const JSStaticValue NX::Classes::Task::Properties[] {
           return NX::Value(ctx, "finished").value();
         case AbstractTask::PENDING:
           return NX::Value(ctx, "pending").value();
+        case AbstractTask::SUSPENDED:
+          return NX::Value(ctx, "suspended").value();
         default:
           return NX::Value(ctx, "unknown").value();
       }
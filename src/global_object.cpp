@@ -278,21 +278,18 @@ static size_t curlWriteCallback(char *ptr, size_t size, size_t nmemb, void * use
   return size * nmemb;
 }
 
-static bool fetchModuleFromURL(const WTF::String &url, WTF::Vector<uint8_t> &buffer) {
+// runs on the blocking pool, so it takes a plain string: WTF::String isn't meant to cross threads
+static bool fetchModuleFromURL(const std::string &utf8URL, WTF::Vector<uint8_t> &buffer) {
   try {
-    static thread_local bool init;
+    // curl_global_init() isn't thread-safe, and the blocking pool has more than one thread
+    static const CURLcode init = curl_global_init(CURL_GLOBAL_ALL);
+    if (init != CURLE_OK)
+      return false;
     CURLcode code;
-    if (!init) {
-      code = curl_global_init(CURL_GLOBAL_ALL);
-      if (code != CURLE_OK)
-        return false;
-      init = true;
-    }
     char errorBuf[CURL_ERROR_SIZE];
     CURL * session = curl_easy_init();
     if (!session)
       return false;
-    std::string utf8URL(url.utf8().data());
     code = curl_easy_setopt(session, CURLOPT_ERRORBUFFER, errorBuf);
     if (code != CURLE_OK)
     {
@@ -449,6 +446,26 @@ NX::GlobalObject::moduleLoaderResolve(JSGlobalObject *globalObject, ExecState *e
 
 }
 
+static JSInternalPromise * resolveModuleSource(ExecState *exec, JSInternalPromiseDeferred *deferred,
+                                               const WTF::String &moduleKey, const WTF::Vector<uint8_t> &buffer) {
+  VM &vm = exec->vm();
+  auto scope = DECLARE_CATCH_SCOPE(vm);
+  JSC::SourceCode source = makeSource(stringFromUTF(buffer),
+                                      SourceOrigin {moduleKey},
+                                      // WTF::URL(moduleKey),
+                                      WTF::URL(),
+                                      TextPosition(),
+                                      SourceProviderSourceType::Module);
+  JSC::ParserError error;
+  if (!JSC::checkModuleSyntax(exec, source, error)) {
+    NX::Nexus::ReportSyntaxError(source, error);
+  }
+
+  auto result = deferred->resolve(exec, JSSourceCode::create(vm, std::move(source)));
+  scope.releaseAssertNoException();
+  return result;
+}
+
 JSInternalPromise *
 NX::GlobalObject::moduleLoaderFetch(JSGlobalObject *globalObject, ExecState *exec, JSModuleLoader *,
                                     JSValue key, JSValue, JSValue) {
@@ -463,30 +480,35 @@ NX::GlobalObject::moduleLoaderFetch(JSGlobalObject *globalObject, ExecState *exe
     return deferred->reject(exec, exception);
   }
 
-  // Here, now we consider moduleKey as the fileName.
-  WTF::Vector<uint8_t> buffer;
-  JSC::SourceCode source;
-
   if (isURL(moduleKey)) {
-    if (!fetchModuleFromURL(moduleKey, buffer)) {
-      return deferred->reject(exec, createError(exec, makeString("Could not open URL '", moduleKey, "'.")));
-    }
-  } else if (!fetchModuleFromLocalFileSystem(moduleKey, buffer))
-    return deferred->reject(exec, createError(exec, makeString("Could not open file '", moduleKey, "'.")));
-  source = makeSource(stringFromUTF(buffer),
-                      SourceOrigin {moduleKey}, 
-                      // WTF::URL(moduleKey),
-                      WTF::URL(),
-                      TextPosition(),
-                      SourceProviderSourceType::Module);
-  JSC::ParserError error;
-  if (!JSC::checkModuleSyntax(exec, source, error)) {
-    NX::Nexus::ReportSyntaxError(source, error);
+    // a download takes as long as the server does, so it goes to the blocking pool; the module loader only
+    // gets its promise settled once it's in, from a regular task
+    auto thisObject = reinterpret_cast<JSCallbackObject<NX::GlobalObject>*>(globalObject);
+    std::string url(moduleKey.utf8().data());
+    auto buffer = std::make_shared<WTF::Vector<uint8_t>>();
+    auto fetched = std::make_shared<bool>(false);
+    JSValueRef deferredRef = toRef(exec, JSValue(deferred));
+    JSValueProtect(toRef(exec), deferredRef);
+    thisObject->nexus()->scheduler()->scheduleBlocking([=]() {
+      *fetched = fetchModuleFromURL(url, *buffer);
+    }, [=]() {
+      ExecState *exec = globalObject->globalExec();
+      JSLockHolder lock(exec);
+      WTF::String name = WTF::String::fromUTF8(url.c_str());
+      if (*fetched)
+        resolveModuleSource(exec, deferred, name, *buffer);
+      else
+        deferred->reject(exec, createError(exec, makeString("Could not open URL '", name, "'.")));
+      JSValueUnprotect(toRef(exec), deferredRef);
+    });
+    return deferred->promise();
   }
 
-  auto result = deferred->resolve(exec, JSSourceCode::create(vm, std::move(source)));
-  scope.releaseAssertNoException();
-  return result;
+  // Here, now we consider moduleKey as the fileName.
+  WTF::Vector<uint8_t> buffer;
+  if (!fetchModuleFromLocalFileSystem(moduleKey, buffer))
+    return deferred->reject(exec, createError(exec, makeString("Could not open file '", moduleKey, "'.")));
+  return resolveModuleSource(exec, deferred, moduleKey, buffer);
 }
 
 JSObject *
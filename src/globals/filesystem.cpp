@@ -23,6 +23,8 @@
 #include "globals/filesystem.h"
 
 #include <boost/filesystem.hpp>
+#include <exception>
+#include <memory>
 #include <globals/promise.h>
 
 JSValueRef NX::Globals::FileSystem::Get (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName, JSValueRef * exception)
@@ -115,22 +117,45 @@ const JSStaticFunction NX::Globals::FileSystem::Methods[] {
   { "stat", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
     size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
       NX::Context * context = Context::FromJsContext(ctx);
+      NX::PromiseHandle promise(ctx);
+      std::string filePath;
       try {
-        std::string filePath = NX::Value(ctx, arguments[0]).toString();
-        boost::filesystem::file_status stats = boost::filesystem::status(filePath);
-        boost::filesystem::perms perms = stats.permissions();
-                boost::filesystem::file_type type = stats.type();
-        NX::Object statsObj(ctx);
-        statsObj.set("type", NX::Value(ctx, type).value());
-        if (stats.type() != boost::filesystem::file_type::file_not_found) {
-          time_t lastMod = boost::filesystem::last_write_time(filePath);
-          statsObj.set("permissions", NX::Value(ctx, perms).value());
-          statsObj.set("lastModified", NX::Object(ctx, lastMod).value());
-        }
-        return NX::Globals::Promise::resolve(ctx, statsObj);
+        if (argumentCount < 1)
+          throw NX::Exception("must supply a path to stat");
+        filePath = NX::Value(ctx, arguments[0]).toString();
       } catch(const std::exception & e) {
-        return NX::Globals::Promise::reject(ctx, NX::Object(context->toJSContext(), e));
+        promise.reject(e);
+        return promise.promise();
       }
+      struct Stat { boost::filesystem::file_status status; time_t lastModified; std::exception_ptr error; };
+      auto stat = std::make_shared<Stat>(Stat { boost::filesystem::file_status(), 0, nullptr });
+      // stat() can take as long as the disk (or the network share) does, so it's kept off the JavaScript threads
+      context->nexus()->scheduler()->scheduleBlocking([=]() {
+        try {
+          stat->status = boost::filesystem::status(filePath);
+          if (stat->status.type() != boost::filesystem::file_type::file_not_found)
+            stat->lastModified = boost::filesystem::last_write_time(filePath);
+        } catch(...) {
+          stat->error = std::current_exception();
+        }
+      }, [=]() {
+        JSContextRef ctx = context->toJSContext();
+        try {
+          if (stat->error)
+            std::rethrow_exception(stat->error);
+          boost::filesystem::file_type type = stat->status.type();
+          NX::Object statsObj(ctx);
+          statsObj.set("type", NX::Value(ctx, type).value());
+          if (type != boost::filesystem::file_type::file_not_found) {
+            statsObj.set("permissions", NX::Value(ctx, stat->status.permissions()).value());
+            statsObj.set("lastModified", NX::Object(ctx, stat->lastModified).value());
+          }
+          promise.resolve(statsObj.value());
+        } catch(const std::exception & e) {
+          promise.reject(e);
+        }
+      });
+      return promise.promise();
     }, 0
   },
   { "join", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
@@ -35,8 +35,6 @@
 
 #include "classes/emitter.h"
 
-#include <boost/thread/pthread/mutex.hpp>
-
 constexpr JSClassDefinition NX::Global::InitGlobalClass()
 {
   JSClassDefinition globalDef = kJSClassDefinitionEmpty;
@@ -46,68 +44,83 @@ constexpr JSClassDefinition NX::Global::InitGlobalClass()
   return globalDef;
 }
 
-static boost::mutex timeoutsMutex;
-static boost::unordered_map<int, NX::AbstractTask *> globalTimeouts;
+static JSValueRef ScheduleTimer(JSContextRef ctx, size_t argumentCount, const JSValueRef arguments[],
+                                JSValueRef* exception, bool repeat)
+{
+  NX::Context * context = NX::Context::FromJsContext(ctx);
+  NX::Nexus * nx = context->nexus();
+  JSC::JSLockHolder lock(toJS(ctx));
+  try {
+    if (argumentCount < 2) {
+      NX::Object exp(ctx, NX::Exception(repeat ? "invalid arguments passed to setInterval" :
+                                                 "invalid arguments passed to setTimeout"));
+      *exception = exp.value();
+      return JSValueMakeUndefined(ctx);
+    }
+    double timeout = NX::Value(ctx, arguments[1]).toNumber();
+    if (!(timeout > 0))
+      timeout = 0;
+    NX::ProtectedArguments saved (context->toJSContext(), 2, arguments);
+    NX::ProtectedArguments args(context->toJSContext(), argumentCount - 2, arguments + 2);
+    auto delay = boost::posix_time::milliseconds((long)timeout);
+    // an interval of zero would make this a one-shot timer
+    auto interval = repeat ? boost::posix_time::milliseconds(std::max((long)timeout, 1L)) : NX::Scheduler::duration();
+    NX::Scheduler::TimerId id = nx->scheduler()->scheduleTimer(delay, [=]() {
+      JSValueRef exp = nullptr;
+      JSObjectCallAsFunction(context->toJSContext(), JSValueToObject(context->toJSContext(), saved[0], &exp),
+                             nullptr, args.size(), args, &exp);
+      if (exp) {
+        NX::Nexus::ReportException(context->toJSContext(), exp);
+      }
+    }, interval);
+    return JSValueMakeNumber(ctx, id);
+  } catch(const std::exception & e) {
+    return JSWrapException(ctx, e, exception);
+  }
+}
+
+static JSValueRef CancelTimer(JSContextRef ctx, size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception)
+{
+  NX::Context * context = NX::Context::FromJsContext(ctx);
+  try {
+    if (argumentCount != 1) {
+      return JSValueMakeUndefined(ctx);
+    }
+    double id = NX::Value(ctx, arguments[0]).toNumber();
+    // stale or bogus ids are simply ignored, the wheel checks the generation for us
+    if (id > 0 && id < 9007199254740992.0)
+      context->nexus()->scheduler()->cancelTimer((NX::Scheduler::TimerId)id);
+  } catch(const std::exception & e) {
+    return JSWrapException(ctx, e, exception);
+  }
+  return JSValueMakeUndefined(ctx);
+}
 
 const JSStaticFunction NX::Global::GlobalFunctions[] {
   { "setTimeout",
     [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount,
        const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef
     {
-      NX::Context * context = Context::FromJsContext(ctx);
-      NX::Nexus * nx = context->nexus();
-      JSC::JSLockHolder lock(toJS(ctx));
-      try {
-        if (argumentCount < 2) {
-          NX::Object exp(ctx, NX::Exception("invalid arguments passed to setTimeout"));
-          *exception = exp.value();
-          return JSValueMakeUndefined(ctx);
-        }
-        NX::Value timeout(ctx, arguments[1]);
-        NX::ProtectedArguments saved (context->toJSContext(), 2, arguments);
-        NX::ProtectedArguments args(context->toJSContext(), argumentCount - 2, arguments + 2);
-        JSValueProtect(context->toJSContext(), arguments[0]);
-        NX::AbstractTask * task = nx->scheduler()->scheduleTask(boost::posix_time::milliseconds((unsigned)timeout.toNumber()), [=]() {
-          JSValueRef exp = nullptr;
-          JSObjectCallAsFunction(context->toJSContext(), JSValueToObject(context->toJSContext(), saved[0], &exp),
-                                 nullptr, args.size(), args, &exp);
-          if (exp) {
-            NX::Nexus::ReportException(context->toJSContext(), exp);
-          }
-        });
-        int id = 1;
-        while(globalTimeouts.find(id) != globalTimeouts.end()) id++;
-        globalTimeouts[id] = task;
-        return JSValueMakeNumber(ctx, id);
-      } catch(const std::exception & e) {
-        return JSWrapException(ctx, e, exception);
-      }
-      return JSValueMakeUndefined(ctx);
+      return ScheduleTimer(ctx, argumentCount, arguments, exception, false);
+    }, 0
+  },
+  { "setInterval",
+    [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount,
+       const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef
+    {
+      return ScheduleTimer(ctx, argumentCount, arguments, exception, true);
     }, 0
   },
   { "clearTimeout",
     [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount,
        const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
-      try {
-        JSC::JSLockHolder lock(toJS(ctx));
-        if (argumentCount != 1) {
-          return JSValueMakeUndefined(ctx);
-        }
-        NX::Value timeoutId(ctx, arguments[0]);
-        int taskId = (int)timeoutId.toNumber();
-        {
-          boost::mutex::scoped_lock lock(timeoutsMutex);
-          if (NX::AbstractTask * task = globalTimeouts[taskId]) {
-            task->abort();
-          } else {
-            /* TODO error */
-          }
-          globalTimeouts.erase(taskId);
-        }
-      } catch(const std::exception & e) {
-        return JSWrapException(ctx, e, exception);
-      }
-      return JSValueMakeUndefined(ctx);
+      return CancelTimer(ctx, argumentCount, arguments, exception);
+    }, 0
+  },
+  { "clearInterval",
+    [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount,
+       const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      return CancelTimer(ctx, argumentCount, arguments, exception);
     }, 0
   },
   { nullptr, nullptr, 0 }
@@ -20,185 +20,500 @@
 #include "nexus.h"
 #include "globals/promise.h"
 
-#include "promise.js.inc"
+NX::Globals::Promise::State::Subscriber NX::Globals::Promise::State::Closed { nullptr, false, nullptr };
+
+namespace {
+  typedef std::shared_ptr<NX::Globals::Promise::State> StatePtr;
+
+  StatePtr * Holder(JSObjectRef object) {
+    return reinterpret_cast<StatePtr*>(JSObjectGetPrivate(object));
+  }
+
+  void Finalize(JSObjectRef object) {
+    delete Holder(object);
+  }
+
+  JSObjectRef MakeTypeError(JSContextRef ctx, const char * message) {
+    NX::Value text(ctx, message);
+    JSValueRef args[] { text.value() };
+    NX::Object global(ctx, JSContextGetGlobalObject(ctx));
+    JSObjectRef TypeError = JSValueToObject(ctx, global["TypeError"]->value(), nullptr);
+    JSObjectRef error = TypeError ? JSObjectCallAsConstructor(ctx, TypeError, 1, args, nullptr) : nullptr;
+    return error ? error : JSObjectMakeError(ctx, 1, args, nullptr);
+  }
+
+  bool IsFunction(JSContextRef ctx, JSValueRef value) {
+    return value && JSValueIsObject(ctx, value) && JSObjectIsFunction(ctx, JSValueToObject(ctx, value, nullptr));
+  }
+
+  bool IsThenable(JSContextRef ctx, JSValueRef value) {
+    if (!value || !JSValueIsObject(ctx, value))
+      return false;
+    JSObjectRef object = JSValueToObject(ctx, value, nullptr);
+    return IsFunction(ctx, JSObjectGetProperty(ctx, object, NX::ScopedString("then"), nullptr));
+  }
+
+  // Array.from() does the iterating, so anything it accepts will do
+  bool ToValues(JSContextRef ctx, JSValueRef iterable, std::vector<JSValueRef> & values, JSValueRef * exception) {
+    if (!iterable || !JSValueIsObject(ctx, iterable)) {
+      *exception = MakeTypeError(ctx, "argument must be iterable");
+      return false;
+    }
+    NX::Object global(ctx, JSContextGetGlobalObject(ctx));
+    NX::Object Array(ctx, global["Array"]->value());
+    JSValueRef list = Array["from"]->toObject()->call(Array, std::vector<JSValueRef> { iterable }, exception);
+    if (*exception)
+      return false;
+    NX::Object array(ctx, list);
+    unsigned length = unsigned(array["length"]->toNumber());
+    values.reserve(length);
+    for(unsigned i = 0; i < length; i++)
+      values.push_back(JSObjectGetPropertyAtIndex(ctx, array, i, nullptr));
+    return true;
+  }
+}
+
+NX::Globals::Promise::State::State(NX::Context * context):
+  myContext(context), myStatus(PENDING), myValue(nullptr), mySubscribers(nullptr), myHandled(false)
+{
+}
+
+NX::Globals::Promise::State::~State()
+{
+  if (myValue)
+    JSValueUnprotect(myContext->toJSContext(), myValue);
+  // never settled: whatever subscribed is dropped without running
+  Subscriber * subscriber = mySubscribers.load(std::memory_order_acquire);
+  while (subscriber && subscriber != &Closed) {
+    Subscriber * next = subscriber->next;
+    delete subscriber;
+    subscriber = next;
+  }
+}
+
+bool NX::Globals::Promise::State::resolve(JSValueRef value)
+{
+  JSContextRef ctx = myContext->toJSContext();
+  if (StatePtr other = FromObject(ctx, value)) {
+    if (other.get() == this)
+      return reject(MakeTypeError(ctx, "A promise cannot be resolved with itself"));
+    int expected = PENDING;
+    if (!myStatus.compare_exchange_strong(expected, ADOPTING, std::memory_order_acq_rel))
+      return false;
+    StatePtr self = shared_from_this();
+    // settle along with the other promise, on the spot rather than a task later
+    other->then([self](JSContextRef, Status status, JSValueRef value) {
+      self->settle(ADOPTING, status, value);
+    }, true);
+    return true;
+  }
+  return settle(PENDING, RESOLVED, value);
+}
+
+bool NX::Globals::Promise::State::reject(JSValueRef value)
+{
+  return settle(PENDING, REJECTED, value);
+}
+
+bool NX::Globals::Promise::State::settle(int from, Status status, JSValueRef value)
+{
+  if (!myStatus.compare_exchange_strong(from, SETTLING, std::memory_order_acq_rel))
+    return false;
+  JSContextRef ctx = myContext->toJSContext();
+  if (!value)
+    value = JSValueMakeUndefined(ctx);
+  JSValueProtect(ctx, value);
+  myValue = value;
+  myStatus.store(status, std::memory_order_release);
+  dispatch(mySubscribers.exchange(&Closed, std::memory_order_acq_rel));
+  myContext->nexus()->scheduler()->checkpoint();
+  return true;
+}
+
+void NX::Globals::Promise::State::then(Continuation && continuation, bool immediate)
+{
+  myHandled.store(true);
+  Subscriber * subscriber = new Subscriber { std::move(continuation), immediate, mySubscribers.load(std::memory_order_acquire) };
+  while (subscriber->next != &Closed) {
+    if (mySubscribers.compare_exchange_weak(subscriber->next, subscriber, std::memory_order_acq_rel))
+      return;
+  }
+  subscriber->next = nullptr;
+  dispatch(subscriber);
+}
+
+void NX::Globals::Promise::State::dispatch(Subscriber * subscribers)
+{
+  NX::Scheduler * scheduler = myContext->nexus()->scheduler();
+  StatePtr self = shared_from_this();
+  Status status = this->status();
+  if (!subscribers) {
+    // nobody is listening yet; give them until the next task to show up before calling it unhandled
+    if (status == REJECTED && !myHandled.load())
+      scheduler->scheduleTask([self]() {
+        if (!self->myHandled.load())
+          NX::Nexus::ReportException(self->myContext->toJSContext(), self->myValue);
+      });
+    return;
+  }
+  // the list was built by pushing onto its head, put it back in subscription order
+  Subscriber * ordered = nullptr;
+  while (subscribers) {
+    Subscriber * next = subscribers->next;
+    subscribers->next = ordered;
+    ordered = subscribers;
+    subscribers = next;
+  }
+  JSContextRef ctx = myContext->toJSContext();
+  Subscriber * queued = nullptr, ** tail = &queued;
+  while (ordered) {
+    Subscriber * subscriber = ordered;
+    ordered = ordered->next;
+    if (subscriber->immediate) {
+      subscriber->continuation(ctx, status, myValue);
+      delete subscriber;
+    } else {
+      subscriber->next = nullptr;
+      *tail = subscriber;
+      tail = &subscriber->next;
+    }
+  }
+  if (!queued)
+    return;
+  // one task for the lot; it owns the list, so it's freed even if the task never gets to run
+  std::shared_ptr<Subscriber> batch(queued, [](Subscriber * subscriber) {
+    while (subscriber) {
+      Subscriber * next = subscriber->next;
+      delete subscriber;
+      subscriber = next;
+    }
+  });
+  scheduler->scheduleTask([self, batch, status]() {
+    JSContextRef ctx = self->myContext->toJSContext();
+    for(Subscriber * subscriber = batch.get(); subscriber; subscriber = subscriber->next) {
+      try {
+        subscriber->continuation(ctx, status, self->myValue);
+      } catch(const std::exception & e) {
+        NX::Nexus::ReportException(e);
+      }
+    }
+  });
+}
+
+bool NX::PromiseHandle::reject(const std::exception & e) const
+{
+  return myState->reject(NX::Object(myState->context()->toJSContext(), e));
+}
+
+JSObjectRef NX::Globals::Promise::create(JSContextRef ctx, std::shared_ptr<State> & state)
+{
+  NX::Context * context = NX::Context::FromJsContext(ctx);
+  static JSClassRef promiseClass = context->nexus()->defineOrGetClass(Class);
+  state = std::make_shared<State>(context);
+  return JSObjectMake(ctx, promiseClass, new StatePtr(state));
+}
+
+std::shared_ptr<NX::Globals::Promise::State> NX::Globals::Promise::FromObject(JSContextRef ctx, JSValueRef value)
+{
+  static JSClassRef promiseClass = NX::Context::FromJsContext(ctx)->nexus()->defineOrGetClass(Class);
+  if (!value || !JSValueIsObjectOfClass(ctx, value, promiseClass))
+    return nullptr;
+  return *Holder(JSValueToObject(ctx, value, nullptr));
+}
 
 JSValueRef NX::Globals::Promise::Get (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName, JSValueRef * exception)
 {
   NX::Context * context = Context::FromJsContext(ctx);
   if (auto Promise = context->getGlobal("Promise"))
       return Promise;
-  JSValueRef Promise = context->evaluateScript(std::string(promise_js, promise_js + promise_js_len),
-                                              nullptr, "promise.js", 1, exception);
-  JSObjectRef promiseObject = JSValueToObject(context->toJSContext(), Promise, exception);
-  if (!*exception)
-    return context->setGlobal("Promise", promiseObject);
-  return JSValueMakeUndefined(ctx);
+  JSClassRef promiseClass = context->nexus()->defineOrGetClass(Class);
+  NX::Object constructor(context->toJSContext(), JSObjectMakeConstructor(context->toJSContext(), promiseClass, Constructor));
+  for(const JSStaticFunction * method = StaticMethods; method->name; method++)
+    constructor.set(method->name, JSObjectMakeFunctionWithCallback(context->toJSContext(), ScopedString(method->name), method->callAsFunction),
+                    kJSPropertyAttributeDontEnum);
+  return context->setGlobal("Promise", constructor);
+}
+
+JSObjectRef NX::Globals::Promise::Constructor (JSContextRef ctx, JSObjectRef constructor, size_t argumentCount,
+                                               const JSValueRef arguments[], JSValueRef * exception)
+{
+  if (!argumentCount || !IsFunction(ctx, arguments[0])) {
+    *exception = MakeTypeError(ctx, "not a function");
+    return JSObjectMake(ctx, nullptr, nullptr);
+  }
+  return JSValueToObject(ctx, createPromise(ctx, JSValueToObject(ctx, arguments[0], nullptr), exception), exception);
 }
 
 JSValueRef NX::Globals::Promise::createPromise (JSContextRef ctx, JSObjectRef executor, JSValueRef * exception)
 {
   NX::Context * context = Context::FromJsContext(ctx);
-  JSObjectRef Promise = JSValueToObject(ctx, context->getOrInitGlobal(ctx, "Promise"), exception);
-  JSValueRef args[]{executor};
-  return JSObjectCallAsConstructor(ctx, Promise, 1, args, exception);
+  static JSClassRef resolverClass = context->nexus()->defineOrGetClass(ResolverClass);
+  static JSClassRef rejecterClass = context->nexus()->defineOrGetClass(RejecterClass);
+  std::shared_ptr<State> state;
+  JSObjectRef promise = create(ctx, state);
+  NX::Object fun(context->toJSContext(), executor);
+  // the executor gets a task of its own, as it always has
+  context->nexus()->scheduler()->scheduleTask([=]() {
+    JSContextRef ctx = context->toJSContext();
+    JSValueRef args[] {
+      JSObjectMake(ctx, resolverClass, new StatePtr(state)),
+      JSObjectMake(ctx, rejecterClass, new StatePtr(state))
+    };
+    JSValueRef exp = nullptr;
+    JSObjectCallAsFunction(ctx, fun, nullptr, 2, args, &exp);
+    if (exp)
+      state->reject(exp);
+  });
+  return promise;
 }
 
 JSObjectRef NX::Globals::Promise::createPromise (JSContextRef ctx, const NX::Globals::Promise::Executor & executor)
 {
   NX::Context * context = Context::FromJsContext(ctx);
-  if (context->nexus()->scheduler()->canYield()) {
-    JSObjectRef ret = nullptr;
-    context->nexus()->scheduler()->scheduleTask([&] {
-      ret = NX::Globals::Promise::createPromise(context->toJSContext(), executor);
-    })->await();
-    return ret;
-  }
-  NX::Object Promise(ctx, context->getOrInitGlobal(ctx, "Promise"));
-  JSValueRef exp = nullptr;
-  JSObjectRef thisObject = JSObjectMake(ctx, context->nexus()->genericClass(), new NX::Globals::Promise::Executor(executor));
-  JSObjectRef jsExecutor = JSBindFunction(ctx, JSObjectMakeFunctionWithCallback(ctx, ScopedString("CreatePromiseExecutor"),
-                                                                                [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
-                                                                                   size_t argumentCount, const JSValueRef originalArguments[],
-                                                                                   JSValueRef * exception) -> JSValueRef
-  {
-    NX::Context * context = NX::Context::FromJsContext(ctx);
-    std::vector<JSValueRef> arguments = std::vector<JSValueRef>(originalArguments, originalArguments + argumentCount);
-    NX::Globals::Promise::Executor executor = *reinterpret_cast<NX::Globals::Promise::Executor*>(JSObjectGetPrivate(thisObject));
-    delete reinterpret_cast<NX::Globals::Promise::Executor*>(JSObjectGetPrivate(thisObject));
-    if (!executor) {
-      NX::Value message(ctx, "promise executor is null");
-      JSValueRef args[] { message.value(), nullptr };
-      *exception = JSObjectMakeError(ctx, 1, args, nullptr);
-      return JSValueMakeUndefined(ctx);
-    }
-    JSObjectRef resolve = JSValueToObject(ctx, arguments[0], nullptr);
-    JSObjectRef reject = JSValueToObject(ctx, arguments[1], nullptr);
+  if (!executor)
+    throw NX::Exception("promise executor is null");
+  std::shared_ptr<State> state;
+  JSObjectRef promise = create(ctx, state);
+  context->nexus()->scheduler()->scheduleTask([=]() {
+    JSContextRef ctx = context->toJSContext();
     try {
-      JSValueProtect(context->toJSContext(), thisObject);
-      JSValueProtect(context->toJSContext(), resolve);
-      JSValueProtect(context->toJSContext(), reject);
-      executor(ctx, [=](JSContextRef ctx, JSValueRef resolveValue) {
-        if (context->nexus()->scheduler()->canYield()) {
-          JSValueProtect(context->toJSContext(), resolveValue);
-          context->nexus()->scheduler()->scheduleTask([=] {
-            JSValueRef args[]{resolveValue};
-            JSValueRef exp = nullptr;
-            JSObjectCallAsFunction(ctx, resolve, nullptr, 1, args, &exp);
-            if (exp) {
-              JSValueRef rejectArgs[]{exp};
-              JSValueRef rejExp = nullptr;
-              JSObjectCallAsFunction(ctx, reject, nullptr, 1, rejectArgs, &rejExp);
-              if (rejExp)
-                NX::Nexus::ReportException(ctx, rejExp);
-            }
-            JSValueUnprotect(context->toJSContext(), resolve);
-            JSValueUnprotect(context->toJSContext(), reject);
-            JSValueUnprotect(context->toJSContext(), resolveValue);
-            JSValueUnprotect(context->toJSContext(), thisObject);
-          })->await();
-        } else {
-          JSValueRef args[]{resolveValue};
-          JSValueRef exp = nullptr;
-          JSObjectCallAsFunction(ctx, resolve, nullptr, 1, args, &exp);
-          if (exp) {
-            JSValueRef rejectArgs[]{exp};
-            JSValueRef rejExp = nullptr;
-            JSObjectCallAsFunction(ctx, reject, nullptr, 1, rejectArgs, &rejExp);
-            if (rejExp)
-              NX::Nexus::ReportException(ctx, rejExp);
-          }
-          JSValueUnprotect(context->toJSContext(), resolve);
-          JSValueUnprotect(context->toJSContext(), reject);
-          JSValueUnprotect(context->toJSContext(), thisObject);
-        }
-      }, [=](JSContextRef ctx, JSValueRef rejectValue) {
-        if (context->nexus()->scheduler()->canYield()) {
-          JSValueProtect(context->toJSContext(), rejectValue);
-          context->nexus()->scheduler()->scheduleTask([=] {
-            JSValueRef args[] { rejectValue };
-            JSValueRef exp = nullptr;
-            JSObjectCallAsFunction(ctx, reject, nullptr, 1, args, &exp);
-            if (exp)
-              NX::Nexus::ReportException(context->toJSContext(), exp);
-            JSValueUnprotect(context->toJSContext(), resolve);
-            JSValueUnprotect(context->toJSContext(), reject);
-            JSValueUnprotect(context->toJSContext(), rejectValue);
-            JSValueUnprotect(context->toJSContext(), thisObject);
-          })->await();
-        } else {
-          JSValueRef args[]{rejectValue};
-          JSValueRef exp = nullptr;
-          JSObjectCallAsFunction(ctx, reject, nullptr, 1, args, &exp);
-          if (exp)
-            NX::Nexus::ReportException(context->toJSContext(), exp);
-          JSValueUnprotect(context->toJSContext(), resolve);
-          JSValueUnprotect(context->toJSContext(), reject);
-          JSValueUnprotect(context->toJSContext(), thisObject);
-        }
-      });
+      executor(ctx, [state](JSContextRef, JSValueRef value) { state->resolve(value); },
+               [state](JSContextRef, JSValueRef value) { state->reject(value); });
     } catch (const std::exception & e) {
-      JSValueRef args[] { NX::Object(context->toJSContext(), e) };
-      JSObjectCallAsFunction(context->toJSContext(), reject, nullptr, 1, args, exception);
-      JSValueUnprotect(context->toJSContext(), resolve);
-      JSValueUnprotect(context->toJSContext(), reject);
-      JSValueUnprotect(context->toJSContext(), thisObject);
+      state->reject(NX::Object(ctx, e));
     }
-    return JSValueMakeUndefined(ctx);
-  }), thisObject, 0, nullptr, nullptr);
-  JSValueRef args[] { jsExecutor };
-  JSObjectRef promise = JSObjectCallAsConstructor(context->toJSContext(), Promise, 1, args, &exp);
-  if (exp) {
-    throw NX::Exception(context->toJSContext(), exp);
-  }
+  });
   return promise;
 }
 
 JSObjectRef NX::Globals::Promise::all (JSContextRef ctx, const std::vector< JSValueRef > & promises)
 {
   NX::Context * context = NX::Context::FromJsContext(ctx);
-  if (context->nexus()->scheduler()->canYield()) {
-    JSObjectRef ret = nullptr;
-    context->nexus()->scheduler()->scheduleTask([&] {
-      ret = NX::Globals::Promise::all(context->toJSContext(), promises);
-    })->await();
-    return ret;
+  std::shared_ptr<State> state;
+  JSObjectRef promise = create(ctx, state);
+  // plain values go into the results as they are, promises overwrite their slot as they resolve
+  NX::Object results(context->toJSContext(), JSObjectMakeArray(ctx, promises.size(), promises.data(), nullptr));
+  auto remaining = std::make_shared<std::atomic_size_t>(1);
+  auto settle = [=](std::size_t i) {
+    return [=](JSContextRef ctx, State::Status status, JSValueRef value) {
+      if (status == State::REJECTED) {
+        state->reject(value);
+        return;
+      }
+      JSObjectSetPropertyAtIndex(ctx, results, unsigned(i), value, nullptr);
+      if (!--*remaining)
+        state->resolve(results);
+    };
+  };
+  // a thenable of some other kind gets its then() called from a task of its own, and they're all queued at once
+  std::vector<NX::Scheduler::CompletionHandler> thenables;
+  for(std::size_t i = 0; i < promises.size(); i++) {
+    if (StatePtr other = FromObject(ctx, promises[i])) {
+      remaining->fetch_add(1);
+      other->then(settle(i), true);
+    } else if (IsThenable(ctx, promises[i])) {
+      remaining->fetch_add(1);
+      NX::Object thenable(context->toJSContext(), promises[i]);
+      thenables.push_back([=]() {
+        JSContextRef ctx = context->toJSContext();
+        if (StatePtr adopted = FromObject(ctx, fromThenable(ctx, thenable)))
+          adopted->then(settle(i), true);
+        else
+          settle(i)(ctx, State::RESOLVED, thenable);
+      });
+    }
   }
-  if (promises.empty()) {
-    return NX::Globals::Promise::resolve(ctx, JSObjectMakeArray(ctx, 0, nullptr, nullptr));
+  context->nexus()->scheduler()->scheduleBatch(std::move(thenables));
+  if (!--*remaining)
+    state->resolve(results);
+  return promise;
+}
+
+JSObjectRef NX::Globals::Promise::race (JSContextRef ctx, const std::vector< JSValueRef > & promises)
+{
+  std::shared_ptr<State> state;
+  JSObjectRef promise = create(ctx, state);
+  for(JSValueRef value : promises) {
+    StatePtr other = FromObject(ctx, value);
+    if (!other) {
+      state->resolve(value);
+      break;
+    }
+    other->then([state](JSContextRef, State::Status status, JSValueRef value) {
+      if (status == State::REJECTED)
+        state->reject(value);
+      else
+        state->resolve(value);
+    }, true);
   }
-  JSValueRef exp = nullptr;
-  JSObjectRef Promise = JSValueToObject(ctx, context->getOrInitGlobal(ctx, "Promise"), &exp);
-  JSObjectRef arr = NX::Object(ctx, promises);
-  return NX::Object(ctx, NX::Object(ctx, Promise)["all"]->toObject()->call(Promise, {arr}, nullptr));
+  return promise;
 }
 
 JSObjectRef NX::Globals::Promise::resolve (JSContextRef ctx, const JSValueRef value)
 {
+  if (FromObject(ctx, value))
+    return JSValueToObject(ctx, value, nullptr);
+  std::shared_ptr<State> state;
+  JSObjectRef promise = create(ctx, state);
+  state->resolve(value);
+  return promise;
+}
+
+JSObjectRef NX::Globals::Promise::reject (JSContextRef ctx, const JSValueRef value)
+{
+  std::shared_ptr<State> state;
+  JSObjectRef promise = create(ctx, state);
+  state->reject(value);
+  return promise;
+}
+
+JSObjectRef NX::Globals::Promise::fromThenable (JSContextRef ctx, JSValueRef value)
+{
+  if (!value || !JSValueIsObject(ctx, value))
+    return nullptr;
+  JSObjectRef object = JSValueToObject(ctx, value, nullptr);
+  if (FromObject(ctx, object))
+    return object;
+  JSValueRef then = JSObjectGetProperty(ctx, object, ScopedString("then"), nullptr);
+  if (!IsFunction(ctx, then))
+    return nullptr;
   NX::Context * context = NX::Context::FromJsContext(ctx);
-  if (context->nexus()->scheduler()->canYield()) {
-    JSObjectRef ret = nullptr;
-    context->nexus()->scheduler()->scheduleTask([&] {
-      ret = NX::Globals::Promise::resolve(context->toJSContext(), value);
-    })->await();
-    return ret;
-  }
+  static JSClassRef resolverClass = context->nexus()->defineOrGetClass(ResolverClass);
+  static JSClassRef rejecterClass = context->nexus()->defineOrGetClass(RejecterClass);
+  std::shared_ptr<State> state;
+  JSObjectRef promise = create(ctx, state);
+  JSValueRef args[] {
+    JSObjectMake(ctx, resolverClass, new StatePtr(state)),
+    JSObjectMake(ctx, rejecterClass, new StatePtr(state))
+  };
   JSValueRef exp = nullptr;
-  JSObjectRef Promise = JSValueToObject(ctx, context->getOrInitGlobal(ctx, "Promise"), &exp);
-  return NX::Object(ctx, NX::Object(ctx, Promise)["resolve"]->toObject()->call(Promise, std::vector<JSValueRef> { value }, nullptr));
+  JSObjectCallAsFunction(ctx, JSValueToObject(ctx, then, nullptr), object, 2, args, &exp);
+  if (exp)
+    state->reject(exp);
+  return promise;
 }
 
-JSObjectRef NX::Globals::Promise::reject (JSContextRef ctx, const JSValueRef value)
+JSObjectRef NX::Globals::Promise::resolved (JSContextRef ctx)
 {
   NX::Context * context = NX::Context::FromJsContext(ctx);
-  if (context->nexus()->scheduler()->canYield()) {
-    JSObjectRef ret = nullptr;
-    context->nexus()->scheduler()->scheduleTask([&] {
-      ret = NX::Globals::Promise::reject(context->toJSContext(), value);
-    })->await();
-    return ret;
+  if (JSValueRef promise = context->getGlobal("@resolvedPromise"))
+    return JSValueToObject(ctx, promise, nullptr);
+  std::shared_ptr<State> state;
+  JSObjectRef promise = create(ctx, state);
+  state->resolve(JSValueMakeUndefined(ctx));
+  context->setGlobal("@resolvedPromise", promise);
+  return promise;
+}
+
+const JSClassDefinition NX::Globals::Promise::Class {
+  0, kJSClassAttributeNone, "Promise", nullptr, nullptr, NX::Globals::Promise::Methods, nullptr, Finalize
+};
+
+const JSClassDefinition NX::Globals::Promise::ResolverClass {
+  0, kJSClassAttributeNone, "PromiseResolveFunction", nullptr, nullptr, nullptr, nullptr, Finalize,
+  nullptr, nullptr, nullptr, nullptr, nullptr,
+  [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+     size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef
+  {
+    (*Holder(function))->resolve(argumentCount ? arguments[0] : JSValueMakeUndefined(ctx));
+    return JSValueMakeUndefined(ctx);
+  }
+};
+
+const JSClassDefinition NX::Globals::Promise::RejecterClass {
+  0, kJSClassAttributeNone, "PromiseRejectFunction", nullptr, nullptr, nullptr, nullptr, Finalize,
+  nullptr, nullptr, nullptr, nullptr, nullptr,
+  [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+     size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef
+  {
+    (*Holder(function))->reject(argumentCount ? arguments[0] : JSValueMakeUndefined(ctx));
+    return JSValueMakeUndefined(ctx);
+  }
+};
+
+namespace {
+  JSValueRef Then(JSContextRef ctx, JSObjectRef thisObject, JSValueRef onResolve, JSValueRef onReject, JSValueRef * exception) {
+    using NX::Globals::Promise;
+    NX::Context * context = NX::Context::FromJsContext(ctx);
+    StatePtr state = Promise::FromObject(ctx, thisObject);
+    if (!state) {
+      *exception = MakeTypeError(ctx, "invalid Promise instance");
+      return JSValueMakeUndefined(ctx);
+    }
+    bool hasResolve = IsFunction(ctx, onResolve), hasReject = IsFunction(ctx, onReject);
+    if (!hasResolve && !hasReject)
+      return Promise::reject(ctx, MakeTypeError(ctx, "invalid arguments passed to promise.then"));
+    NX::Object resolveHandler, rejectHandler;
+    if (hasResolve)
+      resolveHandler = NX::Object(context->toJSContext(), onResolve);
+    if (hasReject)
+      rejectHandler = NX::Object(context->toJSContext(), onReject);
+    StatePtr derived;
+    JSObjectRef promise = Promise::create(ctx, derived);
+    state->then([=](JSContextRef ctx, Promise::State::Status status, JSValueRef value) {
+      const NX::Object & handler = status == Promise::State::RESOLVED ? resolveHandler : rejectHandler;
+      // no handler for this outcome: pass it down the chain
+      if (!handler) {
+        if (status == Promise::State::RESOLVED)
+          derived->resolve(value);
+        else
+          derived->reject(value);
+        return;
+      }
+      JSValueRef exp = nullptr;
+      JSValueRef result = handler.call(nullptr, std::vector<JSValueRef> { value }, &exp);
+      if (exp)
+        derived->reject(exp);
+      else
+        derived->resolve(result);
+    });
+    return promise;
+  }
+
+  JSValueRef Combinator(JSContextRef ctx, size_t argumentCount, const JSValueRef arguments[], JSValueRef * exception,
+                        JSObjectRef (*combine)(JSContextRef, const std::vector<JSValueRef> &))
+  {
+    std::vector<JSValueRef> values;
+    if (!ToValues(ctx, argumentCount ? arguments[0] : nullptr, values, exception))
+      return JSValueMakeUndefined(ctx);
+    return combine(ctx, values);
   }
-  JSValueRef exp = nullptr;
-  JSObjectRef Promise = JSValueToObject(ctx, context->getOrInitGlobal(ctx, "Promise"), &exp);
-  return NX::Object(ctx, NX::Object(ctx, Promise)["reject"]->toObject()->call(Promise, std::vector<JSValueRef> { value }, nullptr));
 }
 
+const JSStaticFunction NX::Globals::Promise::Methods[] {
+  { "then", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      return Then(ctx, thisObject, argumentCount > 0 ? arguments[0] : nullptr, argumentCount > 1 ? arguments[1] : nullptr, exception);
+    }, 0
+  },
+  { "catch", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      return Then(ctx, thisObject, nullptr, argumentCount ? arguments[0] : nullptr, exception);
+    }, 0
+  },
+  { nullptr, nullptr, 0 }
+};
+
+const JSStaticFunction NX::Globals::Promise::StaticMethods[] {
+  { "resolve", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      return NX::Globals::Promise::resolve(ctx, argumentCount ? arguments[0] : JSValueMakeUndefined(ctx));
+    }, 0
+  },
+  { "reject", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      return NX::Globals::Promise::reject(ctx, argumentCount ? arguments[0] : JSValueMakeUndefined(ctx));
+    }, 0
+  },
+  { "all", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      return Combinator(ctx, argumentCount, arguments, exception, NX::Globals::Promise::all);
+    }, 0
+  },
+  { "race", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      return Combinator(ctx, argumentCount, arguments, exception, NX::Globals::Promise::race);
+    }, 0
+  },
+  { nullptr, nullptr, 0 }
+};
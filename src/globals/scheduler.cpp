@@ -3,10 +3,19 @@
 #include "scheduler.h"
 #include "value.h"
 #include "task.h"
+#include "stack_pool.h"
+#include "buffer_pool.h"
 #include "classes/task.h"
+#include "globals/promise.h"
 
 #include <boost/thread.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
 const JSClassDefinition NX::Globals::Scheduler::Class {
   0, kJSClassAttributeNone, "Scheduler", nullptr, NX::Globals::Scheduler::Properties, NX::Globals::Scheduler::Methods
 };
@@ -35,6 +44,17 @@ const JSStaticValue NX::Globals::Scheduler::Properties[] {
       return NX::Value(ctx, scheduler->concurrency()).value();
     }, nullptr, kJSPropertyAttributeReadOnly
   },
+  { "allocations", [](JSContextRef ctx, JSObjectRef object, JSStringRef propertyName, JSValueRef* exception) -> JSValueRef {
+      NX::Object allocations(ctx);
+      allocations.set("tasks", NX::Value(ctx, NX::TaskPool::taskAllocations()).value());
+      allocations.set("handlers", NX::Value(ctx, NX::TaskPool::handlerAllocations()).value());
+      allocations.set("stacks", NX::Value(ctx, NX::StackPool::misses()).value());
+      allocations.set("stacksReused", NX::Value(ctx, NX::StackPool::hits()).value());
+      allocations.set("buffers", NX::Value(ctx, NX::BufferPool::misses()).value());
+      allocations.set("buffersReused", NX::Value(ctx, NX::BufferPool::hits()).value());
+      return allocations.value();
+    }, nullptr, kJSPropertyAttributeReadOnly
+  },
 //  { "Task", [](JSContextRef ctx, JSObjectRef object, JSStringRef propertyName, JSValueRef* exception) -> JSValueRef {
 //      NX::Context * context = NX::Context::FromJsContext(ctx);
 //      if (JSObjectRef Task = JSValueToObject(ctx, context->getGlobal("Nexus.Scheduler.Task"), exception))
@@ -46,15 +66,313 @@ const JSStaticValue NX::Globals::Scheduler::Properties[] {
   { nullptr, nullptr, nullptr, 0 }
 };
 
+namespace {
+  JSValueRef HistogramToObject(JSContextRef ctx, const NX::Histogram & histogram) {
+    // recorded in nanoseconds, reported in microseconds
+    NX::Object object(ctx);
+    object.set("count", NX::Value(ctx, double(histogram.count())).value());
+    object.set("mean", NX::Value(ctx, histogram.mean() / 1000).value());
+    object.set("p50", NX::Value(ctx, histogram.percentile(50) / 1000.0).value());
+    object.set("p90", NX::Value(ctx, histogram.percentile(90) / 1000.0).value());
+    object.set("p99", NX::Value(ctx, histogram.percentile(99) / 1000.0).value());
+    object.set("p999", NX::Value(ctx, histogram.percentile(99.9) / 1000.0).value());
+    object.set("max", NX::Value(ctx, histogram.max() / 1000.0).value());
+    return object.value();
+  }
+
+  NX::Scheduler::CompletionHandler FunctionHandler(NX::Context * context, const NX::Object & fun) {
+    return [=]() {
+      JSValueRef exp = nullptr;
+      NX::Object(fun).call(nullptr, std::vector<JSValueRef>(), &exp);
+      if (exp)
+        NX::Nexus::ReportException(context->toJSContext(), exp);
+    };
+  }
+
+  NX::Scheduler::Priority PriorityOption(JSContextRef ctx, JSValueRef options) {
+    if (!options || !JSValueIsObject(ctx, options))
+      return NX::Scheduler::DEFAULT;
+    auto priority = NX::Object(ctx, options)["priority"];
+    if (JSValueIsUndefined(ctx, priority->value()))
+      return NX::Scheduler::DEFAULT;
+    std::string name = priority->toString();
+    if (name == "interactive")
+      return NX::Scheduler::INTERACTIVE;
+    if (name == "default")
+      return NX::Scheduler::DEFAULT;
+    if (name == "background")
+      return NX::Scheduler::BACKGROUND;
+    throw NX::Exception("priority must be one of 'interactive', 'default' or 'background'");
+  }
+
+  // a chunk's callback threw; the promise is rejected with what the script threw rather than a copy of its message
+  struct ScriptError {
+    std::shared_ptr<NX::Value> error;
+  };
+
+  struct ParallelOptions {
+    std::size_t grain;
+    NX::Scheduler::Priority priority;
+    std::shared_ptr<NX::Value> initial;
+  };
+
+  // Number.MAX_SAFE_INTEGER: past it, a bound or a grain can't have been meant as a count
+  constexpr double MaxSafeInteger = 9007199254740991.0;
+
+  ParallelOptions ParallelOptionsFrom(JSContextRef ctx, JSValueRef options) {
+    ParallelOptions result { 0, PriorityOption(ctx, options), nullptr };
+    if (!options || !JSValueIsObject(ctx, options))
+      return result;
+    NX::Object object(ctx, options);
+    auto grain = object["grain"];
+    if (!JSValueIsUndefined(ctx, grain->value())) {
+      double value = grain->toNumber();
+      if (!(value >= 1))
+        throw NX::Exception("grain must be a positive number");
+      // a grain that big just means a single chunk
+      result.grain = std::size_t(std::min(std::trunc(value), MaxSafeInteger));
+    }
+    auto initial = object["initial"];
+    if (!JSValueIsUndefined(ctx, initial->value()))
+      result.initial = initial;
+    return result;
+  }
+
+  struct TypedArray {
+    NX::Object object;
+    JSTypedArrayType type;
+    char * data;
+    std::size_t length;
+  };
+
+  TypedArray TypedArrayArgument(JSContextRef ctx, JSValueRef value) {
+    JSValueRef exp = nullptr;
+    JSTypedArrayType type = JSValueGetTypedArrayType(ctx, value, &exp);
+    if (exp || type == kJSTypedArrayTypeNone || type == kJSTypedArrayTypeArrayBuffer)
+      throw NX::Exception("argument must be a TypedArray");
+    JSObjectRef object = JSValueToObject(ctx, value, &exp);
+    JSObjectRef buffer = JSObjectGetTypedArrayBuffer(ctx, object, &exp);
+    std::size_t offset = JSObjectGetTypedArrayByteOffset(ctx, object, &exp);
+    std::size_t length = JSObjectGetTypedArrayLength(ctx, object, &exp);
+    char * data = exp ? nullptr : static_cast<char *>(JSObjectGetArrayBufferBytesPtr(ctx, buffer, &exp));
+    if (exp)
+      throw NX::Exception(ctx, exp);
+    return TypedArray { NX::Object(ctx, object), type, data + offset, length };
+  }
+
+  /**
+   * Calls 'visit' with the array's elements as a pointer of the right type. Uint8ClampedArray only clamps on
+   * assignment from script, so reading it as plain bytes is fine.
+   */
+  template <typename Visitor>
+  void VisitElements(const TypedArray & array, Visitor && visit) {
+    switch(array.type) {
+      case kJSTypedArrayTypeInt8Array: return visit(reinterpret_cast<std::int8_t *>(array.data));
+      case kJSTypedArrayTypeInt16Array: return visit(reinterpret_cast<std::int16_t *>(array.data));
+      case kJSTypedArrayTypeInt32Array: return visit(reinterpret_cast<std::int32_t *>(array.data));
+      case kJSTypedArrayTypeUint8Array:
+      case kJSTypedArrayTypeUint8ClampedArray: return visit(reinterpret_cast<std::uint8_t *>(array.data));
+      case kJSTypedArrayTypeUint16Array: return visit(reinterpret_cast<std::uint16_t *>(array.data));
+      case kJSTypedArrayTypeUint32Array: return visit(reinterpret_cast<std::uint32_t *>(array.data));
+      case kJSTypedArrayTypeFloat32Array: return visit(reinterpret_cast<float *>(array.data));
+      case kJSTypedArrayTypeFloat64Array: return visit(reinterpret_cast<double *>(array.data));
+      default: throw NX::Exception("unsupported TypedArray type");
+    }
+  }
+
+  // the order TypedArray.prototype.sort() uses: NaN goes last
+  struct NumericLess {
+    template <typename T>
+    bool operator()(T a, T b) const { return a < b || (b != b && a == a); }
+  };
+
+  enum class NativeReduction { SUM, MIN, MAX };
+
+  // min() and max() behave like Math.min() and Math.max(): a NaN anywhere wins, an empty range gives the identity
+  double Combine(NativeReduction reduction, double a, double b) {
+    if (reduction == NativeReduction::SUM)
+      return a + b;
+    if (a != a || b != b)
+      return std::numeric_limits<double>::quiet_NaN();
+    return reduction == NativeReduction::MIN ? std::min(a, b) : std::max(a, b);
+  }
+
+  double Identity(NativeReduction reduction) {
+    if (reduction == NativeReduction::SUM)
+      return 0;
+    return reduction == NativeReduction::MIN ? std::numeric_limits<double>::infinity()
+                                             : -std::numeric_limits<double>::infinity();
+  }
+
+  template <typename T>
+  double Reduce(NativeReduction reduction, const T * first, const T * last) {
+    if (reduction == NativeReduction::SUM) {
+      // integers are summed exactly, only the total is rounded
+      typename std::conditional<std::is_integral<T>::value, std::int64_t, double>::type sum = 0;
+      for(; first != last; ++first)
+        sum += *first;
+      return double(sum);
+    }
+    double result = Identity(reduction);
+    for(; first != last; ++first)
+      result = Combine(reduction, result, *first);
+    return result;
+  }
+
+  typedef std::function<void(NX::Scheduler::JoinHandler &&)> ParallelStart;
+  typedef std::function<JSValueRef(JSContextRef)> ParallelResult;
+
+  /**
+   * The promise every parallel call returns: 'start' kicks off the work and is handed the handler to call once all
+   * of it is done, after which 'result' produces the value the promise resolves with.
+   */
+  JSObjectRef ParallelPromise(NX::Context * context, const ParallelStart & start, const ParallelResult & result) {
+    return NX::Globals::Promise::createPromise(context->toJSContext(),
+      [=](JSContextRef ctx, NX::ResolveRejectHandler resolve, NX::ResolveRejectHandler reject) {
+        start([=](std::exception_ptr error) {
+          JSContextRef ctx = context->toJSContext();
+          try {
+            if (error)
+              std::rethrow_exception(error);
+            resolve(ctx, result(ctx));
+          } catch(const ScriptError & e) {
+            reject(ctx, e.error->value());
+          } catch(const std::exception & e) {
+            reject(ctx, NX::Object(ctx, e));
+          }
+        });
+      });
+  }
+
+  /**
+   * Sorts every chunk, then merges neighbouring runs pairwise, a round at a time; each round is a parallelFor of its
+   * own, over half as many runs as the one before.
+   */
+  class ParallelSort: public std::enable_shared_from_this<ParallelSort> {
+  public:
+    ParallelSort(NX::Scheduler * scheduler, const TypedArray & array, const ParallelOptions & options):
+      myScheduler(scheduler), myArray(array), myPriority(options.priority),
+      myGrain(options.grain ? options.grain : scheduler->grainFor(array.length)), myDone() {}
+
+    void start(NX::Scheduler::JoinHandler && done) {
+      auto self = shared_from_this();
+      myDone = std::move(done);
+      myScheduler->parallelFor(0, myArray.length, myGrain, [self](std::size_t from, std::size_t to) {
+        VisitElements(self->myArray, [&](auto * elements) { std::sort(elements + from, elements + to, NumericLess()); });
+      }, [self](std::exception_ptr error) { self->merged(self->myGrain, error); }, myPriority);
+    }
+
+  private:
+    void merged(std::size_t width, std::exception_ptr error) {
+      if (error || width >= myArray.length) {
+        // drops the last reference to the job once the promise is settled
+        NX::Scheduler::JoinHandler done = std::move(myDone);
+        done(error);
+        return;
+      }
+      auto self = shared_from_this();
+      std::size_t runs = (myArray.length + 2 * width - 1) / (2 * width);
+      myScheduler->parallelFor(0, runs, 1, [self, width](std::size_t from, std::size_t to) {
+        std::size_t length = self->myArray.length;
+        VisitElements(self->myArray, [&](auto * elements) {
+          for(std::size_t run = from; run < to; run++) {
+            std::size_t first = run * 2 * width;
+            std::size_t middle = std::min(first + width, length), last = std::min(first + 2 * width, length);
+            std::inplace_merge(elements + first, elements + middle, elements + last, NumericLess());
+          }
+        });
+      }, [self, width](std::exception_ptr error) { self->merged(width * 2, error); }, myPriority);
+    }
+
+  private:
+    NX::Scheduler * myScheduler;
+    TypedArray myArray;
+    NX::Scheduler::Priority myPriority;
+    std::size_t myGrain;
+    NX::Scheduler::JoinHandler myDone;
+  };
+
+  const JSStaticFunction StrandMethods[] {
+    { "schedule", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+      size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+        auto context = NX::Context::FromJsContext(ctx);
+        auto * strand = reinterpret_cast<std::shared_ptr<NX::Scheduler::Strand>*>(JSObjectGetPrivate(thisObject));
+        if (!strand || argumentCount != 1 || !JSValueIsObject(ctx, arguments[0]) ||
+            !JSObjectIsFunction(ctx, JSValueToObject(ctx, arguments[0], exception))) {
+          *exception = NX::Object(ctx, NX::Exception("Strand.schedule expects a function"));
+          return JSValueMakeUndefined(ctx);
+        }
+        try {
+          (*strand)->schedule(FunctionHandler(context, NX::Object(context->toJSContext(), arguments[0])));
+        } catch(const std::exception & e) {
+          *exception = NX::Object(ctx, e);
+        }
+        return JSValueMakeUndefined(ctx);
+      }, 0
+    },
+    { nullptr, nullptr, 0 }
+  };
+
+  const JSClassDefinition StrandClass {
+    0, kJSClassAttributeNone, "Strand", nullptr, nullptr, StrandMethods, nullptr,
+    [](JSObjectRef object) { delete reinterpret_cast<std::shared_ptr<NX::Scheduler::Strand>*>(JSObjectGetPrivate(object)); }
+  };
+}
+
 const JSStaticFunction NX::Globals::Scheduler::Methods[] {
+  { "stats", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      auto * scheduler = reinterpret_cast<NX::Scheduler*>(JSObjectGetPrivate(thisObject));
+      try {
+        NX::Scheduler::Stats stats = scheduler->stats();
+        std::vector<JSValueRef> executed;
+        for(auto count : stats.executed)
+          executed.push_back(NX::Value(ctx, double(count)).value());
+        NX::Object result(ctx), timers(ctx), blocking(ctx);
+        result.set("threads", NX::Value(ctx, stats.threads).value());
+        result.set("queued", NX::Value(ctx, stats.queued).value());
+        result.set("active", NX::Value(ctx, stats.active).value());
+        result.set("executed", NX::Object(ctx, executed).value());
+        result.set("steals", NX::Value(ctx, double(stats.steals)).value());
+        result.set("parks", NX::Value(ctx, double(stats.parks)).value());
+        result.set("yields", NX::Value(ctx, double(stats.yields)).value());
+        result.set("cancelled", NX::Value(ctx, double(stats.cancelled)).value());
+        result.set("preemptions", NX::Value(ctx, double(stats.preemptions)).value());
+        timers.set("scheduled", NX::Value(ctx, double(stats.timersScheduled)).value());
+        timers.set("fired", NX::Value(ctx, double(stats.timersFired)).value());
+        timers.set("cancelled", NX::Value(ctx, double(stats.timersCancelled)).value());
+        timers.set("active", NX::Value(ctx, stats.timersActive).value());
+        result.set("timers", timers.value());
+        result.set("queueWait", HistogramToObject(ctx, stats.queueWait));
+        result.set("runTime", HistogramToObject(ctx, stats.runTime));
+        blocking.set("threads", NX::Value(ctx, stats.blocking.threads).value());
+        blocking.set("queued", NX::Value(ctx, stats.blocking.queued).value());
+        blocking.set("executed", NX::Value(ctx, double(stats.blocking.executed)).value());
+        blocking.set("queueWait", HistogramToObject(ctx, stats.blocking.queueWait));
+        blocking.set("runTime", HistogramToObject(ctx, stats.blocking.runTime));
+        result.set("blocking", blocking.value());
+        return result.value();
+      } catch(const std::exception & e) {
+        *exception = NX::Object(ctx, e);
+        return JSValueMakeUndefined(ctx);
+      }
+    }, 0
+  },
   { "schedule", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
     size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
       auto context = Context::FromJsContext(ctx);
       auto * scheduler = reinterpret_cast<NX::Scheduler*>(JSObjectGetPrivate(thisObject));
-      if (argumentCount != 1) {
+      if (argumentCount < 1) {
         *exception = NX::Object(ctx, NX::Exception("Scheduler.schedule called without an argument"));
         return JSValueMakeUndefined(ctx);
       }
+      NX::Scheduler::Priority priority;
+      try {
+        priority = PriorityOption(ctx, argumentCount > 1 ? arguments[1] : nullptr);
+      } catch(const std::exception & e) {
+        *exception = NX::Object(ctx, e);
+        return JSValueMakeUndefined(ctx);
+      }
       if (JSValueGetType(ctx, arguments[0]) != kJSTypeObject) {
         *exception = NX::Object(ctx, NX::Exception("invalid argument passed to Scheduler.schedule"));
         return JSValueMakeUndefined(ctx);
@@ -72,12 +390,16 @@ const JSStaticFunction NX::Globals::Scheduler::Methods[] {
             }
             JSValueUnprotect(context->toJSContext(), fun);
           }, scheduler);
+           taskPtr->setPriority(priority);
            JSValueRef ret = JSValueMakeUndefined(ctx); // NX::Classes::Task::wrapTask(ctx, taskPtr);
            scheduler->scheduleAbstractTask(taskPtr);
+           // a callback queueing the next one is a natural place to give up the thread
+           scheduler->checkpoint();
            return ret;
         } else {
           NX::Classes::Task * taskObj = NX::Classes::Task::FromObject(fun);
           if (taskObj) {
+            taskObj->task()->setPriority(priority);
             scheduler->scheduleAbstractTask(taskObj->task());
           } else {
             *exception = NX::Object(ctx, NX::Exception("argument must be a function or Task instance"));
@@ -89,6 +411,225 @@ const JSStaticFunction NX::Globals::Scheduler::Methods[] {
       return JSValueMakeUndefined(ctx);
     }, 0
   },
+  { "strand", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      auto context = Context::FromJsContext(ctx);
+      auto * scheduler = reinterpret_cast<NX::Scheduler*>(JSObjectGetPrivate(thisObject));
+      return JSObjectMake(ctx, context->nexus()->defineOrGetClass(StrandClass),
+                          new std::shared_ptr<NX::Scheduler::Strand>(scheduler->strand()));
+    }, 0
+  },
+  { "scheduleAll", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      auto context = Context::FromJsContext(ctx);
+      auto * scheduler = reinterpret_cast<NX::Scheduler*>(JSObjectGetPrivate(thisObject));
+      if (argumentCount != 1 || JSValueGetType(ctx, arguments[0]) != kJSTypeObject) {
+        *exception = NX::Object(ctx, NX::Exception("Scheduler.scheduleAll expects an array of functions"));
+        return JSValueMakeUndefined(ctx);
+      }
+      std::vector<NX::AbstractTask*> tasks;
+      try {
+        NX::Object functions(context->toJSContext(), arguments[0]);
+        unsigned int length = (unsigned int)functions["length"]->toNumber();
+        tasks.reserve(length);
+        for(unsigned int i = 0; i < length; i++) {
+          auto value = functions[i];
+          if (!value->isFunction())
+            throw NX::Exception("Scheduler.scheduleAll expects an array of functions");
+          NX::Object fun(context->toJSContext(), value->value());
+          tasks.push_back(new NX::Task([=]() {
+            JSValueRef exp = nullptr;
+            NX::Object(fun).call(nullptr, std::vector<JSValueRef>(), &exp);
+            if (exp)
+              NX::Nexus::ReportException(context->toJSContext(), exp);
+          }, scheduler));
+        }
+      } catch(const std::exception & e) {
+        // all or nothing: the ones already made are queued aborted, so the scheduler disposes of them
+        for(auto task : tasks)
+          task->abort();
+        scheduler->scheduleAbstractTasks(tasks);
+        *exception = NX::Object(ctx, e);
+        return JSValueMakeUndefined(ctx);
+      }
+      scheduler->scheduleAbstractTasks(tasks);
+      return JSValueMakeUndefined(ctx);
+    }, 0
+  },
+  { "parallelFor", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      auto context = Context::FromJsContext(ctx);
+      auto * scheduler = reinterpret_cast<NX::Scheduler*>(JSObjectGetPrivate(thisObject));
+      try {
+        if (argumentCount < 2 || !NX::Value(ctx, arguments[1]).isFunction())
+          throw NX::Exception("Scheduler.parallelFor expects a range and a function");
+        // either a count, or [begin, end)
+        double begin = 0, end = 0;
+        if (JSValueGetType(ctx, arguments[0]) == kJSTypeNumber)
+          end = JSValueToNumber(ctx, arguments[0], nullptr);
+        else if (JSValueGetType(ctx, arguments[0]) == kJSTypeObject) {
+          NX::Object range(ctx, arguments[0]);
+          begin = range[0u]->toNumber();
+          end = range[1u]->toNumber();
+        } else
+          throw NX::Exception("range must be a number or a [begin, end] pair");
+        if (!(begin >= 0) || !(end >= begin) || !(end <= MaxSafeInteger))
+          throw NX::Exception("invalid range passed to Scheduler.parallelFor");
+        begin = std::trunc(begin);
+        end = std::trunc(end);
+        ParallelOptions options = ParallelOptionsFrom(ctx, argumentCount > 2 ? arguments[2] : nullptr);
+        NX::Object fun(context->toJSContext(), arguments[1]);
+        NX::Scheduler::RangeHandler body = [=](std::size_t from, std::size_t to) {
+          JSContextRef ctx = context->toJSContext();
+          JSValueRef exp = nullptr;
+          fun.call(nullptr, { JSValueMakeNumber(ctx, from), JSValueMakeNumber(ctx, to) }, &exp);
+          if (exp)
+            throw ScriptError { std::make_shared<NX::Value>(ctx, exp) };
+        };
+        return ParallelPromise(context, [=](NX::Scheduler::JoinHandler && done) {
+          scheduler->parallelFor(std::size_t(begin), std::size_t(end), options.grain, NX::Scheduler::RangeHandler(body),
+                                 std::move(done), options.priority);
+        }, [](JSContextRef ctx) { return JSValueMakeUndefined(ctx); });
+      } catch(const std::exception & e) {
+        return NX::Globals::Promise::reject(ctx, NX::Object(ctx, e));
+      }
+    }, 0
+  },
+  { "parallelMap", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      auto context = Context::FromJsContext(ctx);
+      auto * scheduler = reinterpret_cast<NX::Scheduler*>(JSObjectGetPrivate(thisObject));
+      try {
+        if (argumentCount < 2 || !NX::Value(ctx, arguments[1]).isFunction())
+          throw NX::Exception("Scheduler.parallelMap expects a TypedArray and a function");
+        TypedArray array = TypedArrayArgument(ctx, arguments[0]);
+        ParallelOptions options = ParallelOptionsFrom(ctx, argumentCount > 2 ? arguments[2] : nullptr);
+        JSValueRef exp = nullptr;
+        JSObjectRef resultObject = JSObjectMakeTypedArray(ctx, array.type, array.length, &exp);
+        if (exp)
+          throw NX::Exception(ctx, exp);
+        // results go through the property setter, which takes care of converting (and clamping) them
+        NX::Object fun(context->toJSContext(), arguments[1]), result(context->toJSContext(), resultObject);
+        NX::Scheduler::RangeHandler body = [=](std::size_t from, std::size_t to) {
+          JSContextRef ctx = context->toJSContext();
+          JSValueRef exp = nullptr;
+          for(std::size_t i = from; i < to && !exp; i++) {
+            JSValueRef value = JSObjectGetPropertyAtIndex(ctx, array.object, unsigned(i), &exp);
+            if (!exp)
+              value = fun.call(nullptr, { value, JSValueMakeNumber(ctx, i) }, &exp);
+            if (!exp)
+              JSObjectSetPropertyAtIndex(ctx, result, unsigned(i), value, &exp);
+          }
+          if (exp)
+            throw ScriptError { std::make_shared<NX::Value>(ctx, exp) };
+        };
+        return ParallelPromise(context, [=](NX::Scheduler::JoinHandler && done) {
+          scheduler->parallelFor(0, array.length, options.grain, NX::Scheduler::RangeHandler(body), std::move(done),
+                                 options.priority);
+        }, [result](JSContextRef ctx) { return result.value(); });
+      } catch(const std::exception & e) {
+        return NX::Globals::Promise::reject(ctx, NX::Object(ctx, e));
+      }
+    }, 0
+  },
+  { "parallelReduce", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      auto context = Context::FromJsContext(ctx);
+      auto * scheduler = reinterpret_cast<NX::Scheduler*>(JSObjectGetPrivate(thisObject));
+      try {
+        if (argumentCount < 2)
+          throw NX::Exception("Scheduler.parallelReduce expects a TypedArray and a function or reduction name");
+        TypedArray array = TypedArrayArgument(ctx, arguments[0]);
+        ParallelOptions options = ParallelOptionsFrom(ctx, argumentCount > 2 ? arguments[2] : nullptr);
+        std::size_t grain = options.grain ? options.grain : scheduler->grainFor(array.length);
+        std::size_t chunks = (array.length + grain - 1) / grain;
+        if (JSValueGetType(ctx, arguments[1]) == kJSTypeString) {
+          // the native reductions never call into script, so their chunks really do run side by side
+          std::string name = NX::Value(ctx, arguments[1]).toString();
+          NativeReduction reduction;
+          if (name == "sum")
+            reduction = NativeReduction::SUM;
+          else if (name == "min")
+            reduction = NativeReduction::MIN;
+          else if (name == "max")
+            reduction = NativeReduction::MAX;
+          else
+            throw NX::Exception("reduction must be a function, or one of 'sum', 'min' or 'max'");
+          double initial = options.initial ? options.initial->toNumber() : Identity(reduction);
+          auto partials = std::make_shared<std::vector<double>>(chunks);
+          NX::Scheduler::RangeHandler body = [=](std::size_t from, std::size_t to) {
+            VisitElements(array, [&](auto * elements) {
+              (*partials)[from / grain] = Reduce(reduction, elements + from, elements + to);
+            });
+          };
+          return ParallelPromise(context, [=](NX::Scheduler::JoinHandler && done) {
+            scheduler->parallelFor(0, array.length, grain, NX::Scheduler::RangeHandler(body), std::move(done),
+                                   options.priority);
+          }, [=](JSContextRef ctx) {
+            double result = initial;
+            for(double partial : *partials)
+              result = Combine(reduction, result, partial);
+            return JSValueMakeNumber(ctx, result);
+          });
+        }
+        if (!NX::Value(ctx, arguments[1]).isFunction())
+          throw NX::Exception("reduction must be a function, or one of 'sum', 'min' or 'max'");
+        if (!array.length && !options.initial)
+          throw NX::Exception("reduce of an empty TypedArray with no initial value");
+        // every chunk is folded from its own first element, and the partial results are folded in order at the end,
+        // so the function has to be associative
+        NX::Object fun(context->toJSContext(), arguments[1]);
+        auto partials = std::make_shared<std::vector<std::shared_ptr<NX::Value>>>(chunks);
+        NX::Scheduler::RangeHandler body = [=](std::size_t from, std::size_t to) {
+          JSContextRef ctx = context->toJSContext();
+          JSValueRef exp = nullptr;
+          JSValueRef accumulator = JSObjectGetPropertyAtIndex(ctx, array.object, unsigned(from), &exp);
+          for(std::size_t i = from + 1; i < to && !exp; i++) {
+            JSValueRef value = JSObjectGetPropertyAtIndex(ctx, array.object, unsigned(i), &exp);
+            if (!exp)
+              accumulator = fun.call(nullptr, { accumulator, value, JSValueMakeNumber(ctx, i) }, &exp);
+          }
+          if (exp)
+            throw ScriptError { std::make_shared<NX::Value>(ctx, exp) };
+          (*partials)[from / grain] = std::make_shared<NX::Value>(ctx, accumulator);
+        };
+        return ParallelPromise(context, [=](NX::Scheduler::JoinHandler && done) {
+          scheduler->parallelFor(0, array.length, grain, NX::Scheduler::RangeHandler(body), std::move(done),
+                                 options.priority);
+        }, [=](JSContextRef ctx) {
+          std::size_t chunk = 0;
+          JSValueRef accumulator = options.initial ? options.initial->value() : (*partials)[chunk++]->value();
+          for(; chunk < partials->size(); chunk++) {
+            JSValueRef exp = nullptr;
+            accumulator = fun.call(nullptr, { accumulator, (*partials)[chunk]->value(),
+                                              JSValueMakeNumber(ctx, chunk * grain) }, &exp);
+            if (exp)
+              throw ScriptError { std::make_shared<NX::Value>(ctx, exp) };
+          }
+          return accumulator;
+        });
+      } catch(const std::exception & e) {
+        return NX::Globals::Promise::reject(ctx, NX::Object(ctx, e));
+      }
+    }, 0
+  },
+  { "parallelSort", [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject,
+    size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      auto context = Context::FromJsContext(ctx);
+      auto * scheduler = reinterpret_cast<NX::Scheduler*>(JSObjectGetPrivate(thisObject));
+      try {
+        if (argumentCount < 1)
+          throw NX::Exception("Scheduler.parallelSort expects a TypedArray");
+        TypedArray array = TypedArrayArgument(ctx, arguments[0]);
+        auto sort = std::make_shared<ParallelSort>(scheduler, array,
+                                                   ParallelOptionsFrom(ctx, argumentCount > 1 ? arguments[1] : nullptr));
+        return ParallelPromise(context, [sort](NX::Scheduler::JoinHandler && done) { sort->start(std::move(done)); },
+                               [array](JSContextRef ctx) { return array.object.value(); });
+      } catch(const std::exception & e) {
+        return NX::Globals::Promise::reject(ctx, NX::Object(ctx, e));
+      }
+    }, 0
+  },
   { nullptr, nullptr, 0 }
 };
 
@@ -1,48 +1,12 @@
 (function() {
-  const eventsKey = Symbol();
-  class EventEmitter2 {
-    constructor() {
-      this[eventsKey] = {};
-    }
-    on(event, functor) {
-      this[eventsKey][event] = this[eventsKey][event] || [];
-      this[eventsKey][event].push({ functor, count: Infinity });
-    }
-    once(event, functor) {
-      this[eventsKey][event] = this[eventsKey][event] || [];
-      this[eventsKey][event].push({ functor, count: 1 });
-    }
-    many(event, functor, count) {
-      this[eventsKey][event] = this[eventsKey][event] || [];
-      this[eventsKey][event].push({ functor, count });
-    }
-    emit(e, ...args) {
-      const event = this[eventsKey][e];
-      if (event) {
-        const events = [], length = event.length;
-        for(let i = 0; i < length; i++) {
-          if (event[i].count-- > 0) {
-            events.push(
-              Promise.resolve(event[i].functor.apply(void 0, args))
-            );
-          }
-        }
-        return Promise.all(events);
-      } else
-        return Promise.resolve([]);
-    }
-    off(event, target) {
-      if (this[eventsKey][event])
-        this[eventsKey][event] = this[eventsKey][event].filter(e => e.functor !== target);
-    }
-    allOff(event) {
-      delete this[eventsKey][event];
-    }
-  }
-  const deviceKey = Symbol(), filtersKey = Symbol();
-  class ReadableStream extends EventEmitter2 {
+  const emitterKey = Symbol(), deviceKey = Symbol(), filtersKey = Symbol();
+  const applyFilters = (filters, data) =>
+    filters.reduce((prev, next) => prev.then(next.process.bind(next)), Promise.resolve(data));
+  // events go through a native EventEmitter; data and end are emitted inline, so a chunk only costs
+  // a promise for the listeners that return one
+  class ReadableStream {
     constructor(device) {
-      super();
+      this[emitterKey] = new Nexus.EventEmitter();
       this[deviceKey] = device;
       this[filtersKey] = [];
       if (device.type !== 'pull' && device.type !== 'push') {
@@ -50,23 +14,43 @@
       }
       if (device.type === 'push') {
         device.on('data', buffer => {
-          return this.filters.reduce((prev, next) => prev.then(next.process.bind(next)), Promise.resolve(buffer))
-            .then(buffer => this.emit('data', buffer), e => this.emit('error', e));
+          if (!this.filters.length)
+            return this[emitterKey].emitInline('data', buffer);
+          return applyFilters(this.filters, buffer)
+            .then(buffer => this[emitterKey].emitInline('data', buffer), e => this.emit('error', e));
         });
         device.on('end', async () => {
           try {
-            const result = await this.filters.reduce((prev, next) => prev.then(next.process.bind(next)), Promise.resolve(null));
-            if (result !== null) await this.emit('data', result);
+            const result = await applyFilters(this.filters, null);
+            if (result !== null) await this[emitterKey].emitInline('data', result);
           }
           catch (e) {
             await this.emit('error', e);
           } finally  {
-            await this.emit('end');
+            await this[emitterKey].emitInline('end');
           }
         });
         device.on('error', e => this.emit('error', e));
       }
     }
+    on(event, functor) {
+      return this[emitterKey].on(event, functor);
+    }
+    once(event, functor) {
+      return this[emitterKey].once(event, functor);
+    }
+    many(event, functor, count) {
+      return this[emitterKey].many(event, functor, count);
+    }
+    emit(e, ...args) {
+      return this[emitterKey].emit(e, ...args);
+    }
+    off(event, target) {
+      return this[emitterKey].off(event, target);
+    }
+    allOff(event) {
+      return this[emitterKey].allOff(event);
+    }
     get filters() { return this[filtersKey]; }
     get device() { return this[deviceKey]; }
     get eof() { return this.device.eof; }
@@ -76,14 +60,14 @@
         try {
           while (!this.device.eof) {
             let buffer = await this.device.read(8 * 1024 * 1024);
-            await this.emit('data', buffer);
+            await this[emitterKey].emitInline('data', buffer);
           }
         }
         catch (e)
         {
           await this.emit('error', e);
         } finally {
-          await this.emit('end');
+          await this[emitterKey].emitInline('end');
         }
         return this;
       } else
@@ -106,9 +90,7 @@
     read() {
       if (this.device.type === 'push')
         throw new TypeError('can not perform read operation on PushSourceDevice');
-      return this.device.read.apply(this.device, arguments).then(data =>
-        this.filters.reduce((prev, next) => prev.then(next.process.bind(next)), Promise.resolve(data))
-      );
+      return this.device.read.apply(this.device, arguments).then(data => applyFilters(this.filters, data));
     }
     readSync() {
       if (this.device.type === 'push')
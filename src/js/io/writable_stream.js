@@ -1,50 +1,30 @@
 (function() {
-  const eventsKey = Symbol();
-  class EventEmitter2 {
-    constructor() {
-      this[eventsKey] = {};
+  const emitterKey = Symbol(), deviceKey = Symbol(), filtersKey = Symbol();
+  // backed by a native EventEmitter, like ReadableStream
+  class WritableStream {
+    constructor(device) {
+      this[emitterKey] = new Nexus.EventEmitter();
+      this[deviceKey] = device;
+      this[filtersKey] = [];
+      device.on('error', e => this.emit('error', e));
     }
     on(event, functor) {
-      this[eventsKey][event] = this[eventsKey][event] || [];
-      this[eventsKey][event].push({ functor, count: Infinity });
+      return this[emitterKey].on(event, functor);
     }
     once(event, functor) {
-      this[eventsKey][event] = this[eventsKey][event] || [];
-      this[eventsKey][event].push({ functor, count: 1 });
+      return this[emitterKey].once(event, functor);
     }
     many(event, functor, count) {
-      this[eventsKey][event] = this[eventsKey][event] || [];
-      this[eventsKey][event].push({ functor, count });
+      return this[emitterKey].many(event, functor, count);
     }
     emit(e, ...args) {
-      const event = this[eventsKey][e];
-      if (event) {
-        const events = [], length = event.length;
-        for(let i = 0; i < length; i++)
-          if (event[i].count-- > 0)
-            events.push(
-              Promise.resolve(event[i].functor.apply(void 0, args))
-            );
-        return Promise.all(events);
-        return Promise.all(events);
-      } else
-        return Promise.resolve([]);
+      return this[emitterKey].emit(e, ...args);
     }
     off(event, target) {
-      if (this[eventsKey][event])
-        this[eventsKey][event] = this[eventsKey][event].filter(e => e.functor !== target);
+      return this[emitterKey].off(event, target);
     }
     allOff(event) {
-      delete this[eventsKey][event];
-    }
-  }
-  const deviceKey = Symbol(), filtersKey = Symbol();
-  class WritableStream extends EventEmitter2 {
-    constructor(device) {
-      super();
-      this[deviceKey] = device;
-      this[filtersKey] = [];
-      device.on('error', e => this.emit('error', e));
+      return this[emitterKey].allOff(event);
     }
     get filters() { return this[filtersKey]; }
     get device() { return this[deviceKey]; }
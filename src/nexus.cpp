@@ -23,6 +23,7 @@
 #include "object.h"
 #include "value.h"
 #include "task.h"
+#include "stack_pool.h"
 #include "globals/global.h"
 
 #include <iostream>
@@ -30,8 +31,13 @@
 #include <fstream>
 #include <exception>
 #include <cstring>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include <boost/thread.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/context/stack_traits.hpp>
 
 #include <JavaScriptCore/JSContextRef.h>
 #include <JavaScriptCore/API/APICast.h>
@@ -43,6 +49,46 @@
 
 namespace po = boost::program_options;
 
+/**
+ * The number of CPUs we can actually use: the affinity mask, further limited by the cgroup v2 'cpu.max'
+ * quota of our cgroup or any of its ancestors, so we don't over-subscribe when running in a container.
+ */
+static unsigned int DefaultConcurrency()
+{
+  unsigned int cpus = std::max(boost::thread::hardware_concurrency(), 1u);
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (!sched_getaffinity(0, sizeof(set), &set) && CPU_COUNT(&set) > 0)
+    cpus = std::min(cpus, (unsigned int)CPU_COUNT(&set));
+  std::ifstream cgroups("/proc/self/cgroup");
+  std::string line, path;
+  while (std::getline(cgroups, line)) {
+    if (line.compare(0, 3, "0::") == 0)
+      path = line.substr(3);
+  }
+  if (!path.empty()) {
+    const std::string root("/sys/fs/cgroup");
+    std::string dir = root + (path == "/" ? "" : path);
+    while (true) {
+      std::ifstream max(dir + "/cpu.max");
+      std::string quota;
+      unsigned long long period = 0;
+      if (max >> quota >> period && quota != "max" && period) {
+        try {
+          auto limit = (std::stoull(quota) + period - 1) / period;
+          cpus = std::min(cpus, (unsigned int)std::max(limit, 1ull));
+        } catch(const std::exception &) {}
+      }
+      if (dir.size() <= root.size())
+        break;
+      dir = dir.substr(0, dir.rfind('/'));
+    }
+  }
+#endif
+  return cpus;
+}
+
 NX::Nexus::Nexus(int argc, const char ** argv):
   argc(argc), argv(argv), myArguments(), myContextGroup(nullptr), myMainContext(nullptr),
   myScriptLoaders(), myScriptPath(), myScheduler(nullptr), myOptions(), myClasses(), myExitStatus(0)
@@ -67,8 +113,24 @@ bool NX::Nexus::parseArguments()
     ("help", "produce this help message")
     ("version,v", "print version and exit")
     ("silent,s", "don't print errors")
-    ("concurrency", po::value<unsigned int>(&nThreads)->default_value(boost::thread::hardware_concurrency()),
-      "maximum threads in the task scheduler's pool (defaults to the available number of threads)")
+    ("concurrency", po::value<unsigned int>(&nThreads)->default_value(DefaultConcurrency()),
+      "maximum threads in the task scheduler's pool (defaults to the number of CPUs available to the process, "
+      "including cgroup quotas)")
+    ("min-concurrency", po::value<unsigned int>()->default_value(1),
+      "threads the task scheduler keeps alive while idle")
+    ("thread-idle-timeout", po::value<unsigned int>()->default_value(5000),
+      "milliseconds a scheduler thread may sit idle before it exits")
+    ("affinity", "pin each task scheduler thread to a CPU of its own")
+    ("numa", "keep each task scheduler thread and its task queue on one NUMA node")
+    ("shard-io", "give each task scheduler thread an I/O reactor of its own, and keep every socket on one of them")
+    ("blocking-concurrency", po::value<unsigned int>()->default_value(4),
+      "threads in the pool that runs blocking file and socket calls")
+    ("task-slice-us", po::value<unsigned int>()->default_value(0),
+      "microseconds a coroutine may run before it yields at the next safe point (0 never preempts)")
+    ("stack-size", po::value<std::size_t>()->default_value(boost::context::stack_traits::default_size() / 1024),
+      "coroutine stack size in KiB, not counting the guard page")
+    ("stack-pool", po::value<std::size_t>()->default_value(64),
+      "number of finished coroutine stacks each thread keeps for reuse")
     ("loader,l", po::value<std::vector<std::string>>(), "ES6 module loader to use - must export `resolve()`")
     ("module,m", po::value<std::string>(), "module to load");
   po::positional_options_description module;
@@ -131,7 +193,13 @@ void NX::Nexus::ReportException(const std::exception &e) {
 void NX::Nexus::initScheduler()
 {
   auto concurrency = myOptions["concurrency"].as<unsigned int>();
-  myScheduler.reset(new Scheduler(this, concurrency));
+  NX::StackPool::configure(myOptions["stack-size"].as<std::size_t>() * 1024, myOptions["stack-pool"].as<std::size_t>());
+  myScheduler.reset(new Scheduler(this, concurrency, myOptions["min-concurrency"].as<unsigned int>(),
+                                  boost::posix_time::milliseconds(myOptions["thread-idle-timeout"].as<unsigned int>())));
+  myScheduler->setPlacement(myOptions.count("affinity"), myOptions.count("numa"));
+  myScheduler->setShardedIO(myOptions.count("shard-io"));
+  myScheduler->setBlockingConcurrency(myOptions["blocking-concurrency"].as<unsigned int>());
+  myScheduler->setTaskSlice(boost::posix_time::microseconds(myOptions["task-slice-us"].as<unsigned int>()));
 }
 
 int NX::Nexus::run() {
@@ -216,17 +216,19 @@ JSValueRef NX::Object::await() {
   auto context = NX::Context::FromJsContext(myContext);
   auto scheduler = context->nexus()->scheduler();
   JSValueRef result = nullptr, exception = nullptr;
-  this->then([&](JSContextRef ctx, JSValueRef res, JSValueRef*) {
-    result = res;
-    JSValueProtect(context->toJSContext(), result);
-    return JSValueMakeUndefined(ctx);
-  }, [&](JSContextRef ctx, JSValueRef exp, JSValueRef*) {
-    exception = exp;
-    JSValueProtect(context->toJSContext(), exp);
-    return JSValueMakeUndefined(ctx);
+  scheduler->suspend([&](const NX::Scheduler::CompletionHandler & resume) {
+    this->then([&, resume](JSContextRef ctx, JSValueRef res, JSValueRef*) {
+      result = res;
+      JSValueProtect(context->toJSContext(), result);
+      resume();
+      return JSValueMakeUndefined(ctx);
+    }, [&, resume](JSContextRef ctx, JSValueRef exp, JSValueRef*) {
+      exception = exp;
+      JSValueProtect(context->toJSContext(), exp);
+      resume();
+      return JSValueMakeUndefined(ctx);
+    });
   });
-  while(!result && !exception)
-    scheduler->yield();
   if (exception) {
     JSValueUnprotect(context->toJSContext(), exception);
   }
@@ -22,6 +22,14 @@
 #include "task.h"
 
 #include <functional>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <sstream>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include <JavaScriptCore/runtime/InitializeThreading.h>
 #include <JavaScriptCore/heap/GCDeferralContext.h>
 #include <JavaScriptCore/heap/GCDeferralContextInlines.h>
@@ -29,19 +37,94 @@
 #include <JavaScriptCore/heap/HeapInlines.h>
 #include <JavaScriptCore/heap/MachineStackMarker.h>
 
-NX::Scheduler::Scheduler (NX::Nexus * nexus, unsigned int maxThreads):
-  myNexus(nexus), myMaxThreads(maxThreads), myThreadCount(0), myService(), myWork(),
-  myThreadGroup(), myCurrentTask(nullptr), myTaskQueue(256), myTaskCount(0), myActiveTaskCount(0), myHoldCount(0),
-  myPauseTasks(false)
+thread_local NX::AbstractTask * NX::Scheduler::CurrentTask::current = nullptr;
+thread_local std::uint64_t NX::Scheduler::CurrentTask::entered = 0;
+constexpr unsigned NX::Scheduler::SampleInterval;
+constexpr std::size_t NX::Scheduler::DrainBatch;
+constexpr unsigned NX::Scheduler::PriorityCount;
+constexpr std::size_t NX::Scheduler::DefaultShare;
+constexpr std::size_t NX::Scheduler::BackgroundShare;
+constexpr std::size_t NX::Scheduler::Strand::Batch;
+thread_local const NX::Scheduler::Strand * NX::Scheduler::Strand::Current = nullptr;
+
+namespace {
+  // whether the calling thread is parked on the shared reactor, and whether it ran into a wake-up that wasn't for it
+  thread_local bool parkedOnService = false;
+  thread_local bool passedWakeup = false;
+
+  std::vector<int> parseCpuList(const std::string & list)
+  {
+    // the kernel's format: "0-3,8-11"
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+      if (range.empty() || !std::isdigit((unsigned char)range[0]))
+        continue;
+      std::size_t dash = range.find('-');
+      int first = std::stoi(range), last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for(int cpu = first; cpu <= last; cpu++)
+        cpus.push_back(cpu);
+    }
+    return cpus;
+  }
+
+  /**
+   * The CPUs this process may run on, grouped by NUMA node.
+   */
+  std::map<int, std::vector<int>> cpuTopology()
+  {
+    std::map<int, std::vector<int>> nodes;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+      return nodes;
+    std::map<int, int> nodeOf;
+    for(int node = 0; ; node++) {
+      std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      std::string list;
+      if (!std::getline(file, list))
+        break;
+      for(int cpu : parseCpuList(list))
+        nodeOf[cpu] = node;
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed))
+        nodes[nodeOf.count(cpu) ? nodeOf[cpu] : 0].push_back(cpu);
+    }
+#endif
+    return nodes;
+  }
+}
+
+NX::Scheduler::Scheduler (NX::Nexus * nexus, unsigned int maxThreads, unsigned int minThreads,
+                          const duration & idleTimeout):
+  myNexus(nexus), myMaxThreads(std::max(maxThreads, 1u)), myMinThreads(std::min(minThreads, maxThreads)),
+  myIdleTimeout(std::max<std::int64_t>(idleTimeout.total_milliseconds(), 1)),
+  myThreadCount(0), myPoolSize(0), myStartingThreads(0), myService(), myWork(),
+  myTimerEpoch(std::chrono::steady_clock::now()), myTimer(), myTimerArmedAt(NX::TimerWheel::NoTick), myTimerWheel(), myTimerLock(),
+  myTimersScheduled(0), myTimersFired(0), myTimersCancelled(0),
+  myThreads(), myRetiredThreads(), myThreadsLock(), myCurrentTask(), myCurrentWorker([](Worker *) {}), myWorkers(), myNodeLocal(false),
+  myShardedIO(false), myNextService(0), myTimerWatcher(nullptr), mySharedCounters(), myInjectionQueues(),
+  myTaskCount(0), myActiveTaskCount(0), myHoldCount(0), myIdleCount(0), myPendingWakeups(0), myServiceIdleCount(0), myPauseTasks(false),
+  myBlockingLock(), myBlockingCondition(), myBlockingQueue(), myBlockingThreads(), myBlockingMaxThreads(4), myBlockingIdle(0),
+  myBlockingStopped(false), myBlockingExecuted(0), myBlockingQueueWait(), myBlockingRunTime(), myTaskSlice(0)
 {
-  myService.reset(new boost::asio::io_service(maxThreads));
+  myService.reset(new boost::asio::io_service(myMaxThreads));
+  for(auto & queue : myInjectionQueues)
+    queue.reset(new TaskQueue(256));
   myService->stop();
+  myTimer.reset(new boost::asio::steady_timer(*myService));
+  // one slot per pool thread, plus one for the thread that calls joinPool()
+  for(unsigned int i = 0; i <= myMaxThreads; i++)
+    myWorkers.emplace_back(new Worker(0x9E3779B9u * (i + 1)));
 }
 
 NX::Scheduler::~Scheduler()
 {
   this->stop();
-  myThreadGroup.join_all();
+  this->join();
   for(auto task : myThreadInitQueue) {
     delete task;
   }
@@ -50,12 +133,31 @@ NX::Scheduler::~Scheduler()
 
 void NX::Scheduler::addThread()
 {
-  myThreadGroup.add_thread(new boost::thread(boost::bind(&NX::Scheduler::dispatcher, this)));
+  myPoolSize++;
+  myStartingThreads++;
+  myThreads.emplace_back(boost::bind(&NX::Scheduler::dispatcher, this, CompletionHandler(), true));
+}
+
+void NX::Scheduler::reapThreads()
+{
+  // these have moved themselves here as the very last thing they did, so joining them won't block for long
+  for(auto & thread : myRetiredThreads)
+    thread.join();
+  myRetiredThreads.clear();
 }
 
-void NX::Scheduler::dispatcher()
+bool NX::Scheduler::retireThread()
+{
+  std::size_t size = myPoolSize;
+  while (size > myMinThreads) {
+    if (myPoolSize.compare_exchange_weak(size, size - 1))
+      return true;
+  }
+  return false;
+}
+
+void NX::Scheduler::dispatcher(const CompletionHandler & idleHandler, bool pooled)
 {
-  static const std::chrono::microseconds delay(200);
   for(auto task : myThreadInitQueue) {
     if (task->status() != NX::AbstractTask::Status::ABORTED) {
       task->create();
@@ -63,17 +165,344 @@ void NX::Scheduler::dispatcher()
       task->exit();
     }
   }
+  if (pooled)
+    myStartingThreads--;
   myThreadCount++;
-  while (myService->poll_one() || queued())
+  Worker * worker = attachWorker(pooled);
+  bool retired = false;
+  while (!myService->stopped())
   {
-    if (!drainTasks()) {
-      std::this_thread::sleep_for(delay);
+    std::size_t processed = myService->poll_one();
+    if (passedWakeup) {
+      // posted from here rather than from the handler, where asio may keep it to this thread without telling anyone
+      passedWakeup = false;
+      processed--;
+      postWakeup();
+    }
+    if (worker && worker->service())
+      processed += worker->service()->poll_one();
+    processed += drainTasks();
+    if (processed)
+      continue;
+    if (idleHandler)
+      idleHandler();
+    if (!remaining() && !myHoldCount) {
+      // our own poll_one() may have eaten a wake-up meant for a parked thread, so pass it on
+      notifyAll();
+      break;
     }
-    std::this_thread::yield();
-    if (myService->stopped())
+    // a pool thread that sat through a whole idle timeout without being needed leaves, unless we're at the floor
+    if (park(!pooled) && (retired = retireThread()))
       break;
   }
+  detachWorker(worker);
   myThreadCount--;
+  if (pooled) {
+    if (!retired)
+      myPoolSize--;
+    // join() may have taken us off the list already, in which case it's joining us as we speak
+    boost::mutex::scoped_lock lock(myThreadsLock);
+    for(auto i = myThreads.begin(); i != myThreads.end(); i++) {
+      if (i->get_id() == boost::this_thread::get_id()) {
+        myRetiredThreads.splice(myRetiredThreads.end(), myThreads, i);
+        break;
+      }
+    }
+  }
+}
+
+bool NX::Scheduler::park(bool joining)
+{
+  // the thread calling joinPool() also has to service its idle handler, so it only naps
+  static const std::chrono::milliseconds idleHandlerInterval(1);
+  Worker * worker = myCurrentWorker.get();
+  boost::asio::io_service * reactor = worker ? worker->service().get() : nullptr;
+  myIdleCount++;
+  if (reactor)
+    worker->park();
+  // re-check after announcing ourselves, so a concurrent notify() can't slip in between
+  if ((queued() && !myPauseTasks) || (!remaining() && !myHoldCount)) {
+    if (reactor)
+      worker->unpark();
+    myIdleCount--;
+    return false;
+  }
+  Counters::increment(counters().parks);
+  std::chrono::milliseconds timeout = joining ? idleHandlerInterval : myIdleTimeout;
+  bool timedOut;
+  if (reactor) {
+    // nobody sleeps on the shared reactor and its timer, so one parked worker at a time keeps an eye on the clock
+    Worker * watcher = nullptr;
+    bool watching = myTimerWatcher.compare_exchange_strong(watcher, worker);
+    timedOut = !reactor->run_one_for(watching ? untilTimer(timeout) : timeout);
+    if (watching)
+      myTimerWatcher.store(nullptr);
+    worker->unpark();
+  } else {
+    // a single wait on the reactor: returns on any I/O completion, or on a wake-up posted by notify()
+    myServiceIdleCount++;
+    parkedOnService = true;
+    timedOut = !myService->run_one_for(timeout);
+    parkedOnService = false;
+    myServiceIdleCount--;
+  }
+  myIdleCount--;
+  return timedOut && !joining;
+}
+
+std::chrono::milliseconds NX::Scheduler::untilTimer(const std::chrono::milliseconds & timeout) const
+{
+  NX::TimerWheel::Tick armedAt = myTimerArmedAt;
+  if (armedAt == NX::TimerWheel::NoTick)
+    return timeout;
+  auto left = myTimerEpoch + std::chrono::milliseconds(armedAt) - std::chrono::steady_clock::now();
+  // rounded up, or we'd wake just short of the deadline and go straight back to sleep
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(left) + std::chrono::milliseconds(1);
+  return std::max(std::min(wait, timeout), std::chrono::milliseconds(0));
+}
+
+void NX::Scheduler::notify(std::size_t count)
+{
+  while (count-- && myIdleCount > myPendingWakeups)
+    wake();
+}
+
+void NX::Scheduler::notifyAll()
+{
+  while (myIdleCount > myPendingWakeups)
+    wake();
+}
+
+void NX::Scheduler::wake()
+{
+  myPendingWakeups++;
+  // with sharded I/O, parked workers sleep on their own reactors rather than on the shared one
+  if (myShardedIO) {
+    for(auto & worker : myWorkers) {
+      if (worker->unpark()) {
+        worker->service()->post([this] { myPendingWakeups--; });
+        return;
+      }
+    }
+  }
+  postWakeup();
+}
+
+void NX::Scheduler::postWakeup()
+{
+  myService->post([this] {
+    // busy threads poll the shared reactor between tasks and may get here first; they hand the wake-up back for as
+    // long as anyone is parked on it, or that thread would sleep through its idle timeout with work queued
+    if (!parkedOnService && myServiceIdleCount) {
+      passedWakeup = true;
+      return;
+    }
+    myPendingWakeups--;
+  });
+}
+
+void NX::Scheduler::wake(NX::Scheduler::Worker * worker)
+{
+  if (!worker->unpark())
+    return;
+  myPendingWakeups++;
+  worker->service()->post([this] { myPendingWakeups--; });
+}
+
+NX::Scheduler::Worker * NX::Scheduler::attachWorker(bool pin)
+{
+  // pool threads take the first free slot, the thread calling joinPool() prefers the last one, which is its own
+  std::size_t count = myWorkers.size();
+  for(std::size_t i = 0; i < count; i++) {
+    Worker * worker = myWorkers[pin ? i : (count - 1 + i) % count].get();
+    if (worker->claim()) {
+      myCurrentWorker.reset(worker);
+#ifdef __linux__
+      // the thread calling joinPool() belongs to the embedder, so only our own threads are moved around
+      if (pin && !worker->cpus().empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : worker->cpus())
+          CPU_SET(cpu, &set);
+        if (!pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+          worker->localize();
+      }
+#endif
+      return worker;
+    }
+  }
+  // no free slot, this thread will only use the injection queue and steal
+  return nullptr;
+}
+
+void NX::Scheduler::detachWorker(NX::Scheduler::Worker * worker)
+{
+  if (!worker) return;
+  myCurrentWorker.reset(nullptr);
+  // hand anything left behind to the remaining threads
+  while (NX::AbstractTask * task = worker->steal())
+    myInjectionQueues[lane(task)]->push(task);
+  worker->unclaim();
+}
+
+void NX::Scheduler::requeueTask(NX::AbstractTask * task)
+{
+  myTaskCount++;
+  task->myQueuedAt = sampleTime();
+  task->myQueueState.store(NX::AbstractTask::QUEUED, std::memory_order_relaxed);
+  Counters::increment(counters().yields);
+  // yielded tasks go to the far end of the local deque so they don't starve the work they're waiting on
+  if (Worker * worker = myCurrentWorker.get())
+    worker->pushFront(task);
+  else
+    myInjectionQueues[lane(task)]->push(task);
+}
+
+NX::AbstractTask * NX::Scheduler::nextTask()
+{
+  NX::AbstractTask * task = nullptr;
+  Worker * worker = myCurrentWorker.get();
+  // threads without a worker have no tick of their own to age the lower lanes with, they just go top down
+  unsigned favoured = INTERACTIVE;
+  if (worker) {
+    std::size_t tick = worker->tick();
+    favoured = favouredLane(tick);
+    // every so often, look at the oldest work first so a self-rescheduling task can't starve everything else
+    if (tick % 61 == 0) {
+      if ((task = popInjected(favoured)))
+        return task;
+      if ((task = worker->steal(favoured)))
+        return task;
+    }
+    // local work comes first for locality, unless there's something more urgent waiting to be injected
+    if ((task = worker->pop(favoured, injectedLane())))
+      return task;
+  }
+  if ((task = popInjected(favoured)))
+    return task;
+  if ((task = stealTask(worker, favoured)))
+    Counters::increment(counters().steals);
+  return task;
+}
+
+NX::AbstractTask * NX::Scheduler::popInjected(unsigned favoured)
+{
+  NX::AbstractTask * task = nullptr;
+  if (myInjectionQueues[favoured]->pop(task))
+    return task;
+  for(auto & queue : myInjectionQueues) {
+    if (queue->pop(task))
+      return task;
+  }
+  return nullptr;
+}
+
+unsigned NX::Scheduler::injectedLane() const
+{
+  for(unsigned lane = 0; lane < PriorityCount; lane++) {
+    if (!myInjectionQueues[lane]->empty())
+      return lane;
+  }
+  return PriorityCount;
+}
+
+NX::AbstractTask * NX::Scheduler::stealTask(NX::Scheduler::Worker * thief, unsigned favoured)
+{
+  const std::size_t count = myWorkers.size();
+  std::size_t start = thief ? thief->random() % count : 0;
+  // the first pass only looks at our own node, so tasks (and the memory they touch) stay put when they can
+  for(int pass = myNodeLocal && thief ? 0 : 1; pass < 2; pass++) {
+    for(std::size_t i = 0; i < count; i++) {
+      Worker * victim = myWorkers[(start + i) % count].get();
+      if (victim == thief || (!pass && victim->node() != thief->node()))
+        continue;
+      if (NX::AbstractTask * task = victim->steal(favoured))
+        return task;
+    }
+  }
+  return nullptr;
+}
+
+unsigned NX::Scheduler::lane(const NX::AbstractTask * task)
+{
+  return task->myPriority;
+}
+
+bool NX::Scheduler::claimTask(NX::AbstractTask * task)
+{
+  int state = NX::AbstractTask::QUEUED;
+  while (!task->myQueueState.compare_exchange_weak(state, NX::AbstractTask::UNQUEUED)) {
+    if (state == NX::AbstractTask::CANCELLED)
+      return false;
+    // either a spurious failure, or unschedule() is still uncounting it, which won't take long
+    state = NX::AbstractTask::QUEUED;
+  }
+  return true;
+}
+
+bool NX::Scheduler::unschedule(NX::AbstractTask * task)
+{
+  int state = NX::AbstractTask::QUEUED;
+  if (!task->myQueueState.compare_exchange_strong(state, NX::AbstractTask::CANCELLING))
+    return false;
+  myTaskCount--;
+  Counters::increment(counters().cancelled);
+  // from here on, the thread that pops it owns it; abort() has it pinned, so it can't be freed before that's done
+  task->myQueueState.store(NX::AbstractTask::CANCELLED);
+  return true;
+}
+
+NX::Scheduler::Counters & NX::Scheduler::counters()
+{
+  Worker * worker = myCurrentWorker.get();
+  return worker ? worker->counters() : mySharedCounters;
+}
+
+std::uint64_t NX::Scheduler::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::uint64_t NX::Scheduler::sampleTime()
+{
+  // 0 marks a task that isn't being timed
+  static thread_local unsigned ticks = 0;
+  return ++ticks % SampleInterval ? 0 : now();
+}
+
+NX::Scheduler::Stats NX::Scheduler::stats()
+{
+  Stats stats;
+  stats.threads = myThreadCount;
+  stats.queued = myTaskCount;
+  stats.active = myActiveTaskCount;
+  stats.steals = stats.parks = stats.yields = stats.cancelled = stats.preemptions = 0;
+  auto collect = [&stats](const Counters & counters) {
+    stats.executed.push_back(counters.executed.load(std::memory_order_relaxed));
+    stats.steals += counters.steals.load(std::memory_order_relaxed);
+    stats.parks += counters.parks.load(std::memory_order_relaxed);
+    stats.yields += counters.yields.load(std::memory_order_relaxed);
+    stats.cancelled += counters.cancelled.load(std::memory_order_relaxed);
+    stats.preemptions += counters.preemptions.load(std::memory_order_relaxed);
+    stats.queueWait.merge(counters.queueWait);
+    stats.runTime.merge(counters.runTime);
+  };
+  for(auto & worker : myWorkers)
+    collect(worker->counters());
+  collect(mySharedCounters);
+  boost::mutex::scoped_lock lock(myTimerLock);
+  stats.timersScheduled = myTimersScheduled;
+  stats.timersFired = myTimersFired;
+  stats.timersCancelled = myTimersCancelled;
+  stats.timersActive = myTimerWheel.size();
+  lock.unlock();
+  boost::mutex::scoped_lock blockingLock(myBlockingLock);
+  stats.blocking.threads = myBlockingThreads.size();
+  stats.blocking.queued = myBlockingQueue.size();
+  stats.blocking.executed = myBlockingExecuted;
+  stats.blocking.queueWait = myBlockingQueueWait;
+  stats.blocking.runTime = myBlockingRunTime;
+  return stats;
 }
 
 void NX::Scheduler::makeCurrent (NX::AbstractTask * task)
@@ -85,40 +514,119 @@ std::size_t NX::Scheduler::drainTasks()
 {
   if (myPauseTasks) return 0;
   std::size_t processed = 0;
-  NX::AbstractTask * task = nullptr;
-  while (myTaskQueue.pop(task))
+  Counters & counters = this->counters();
+  while (NX::AbstractTask * task = nextTask())
   {
+    if (!claimTask(task)) {
+      // a tombstone: already uncounted by unschedule(), and emptied out by the abort() that put it there
+      task->dispose();
+      continue;
+    }
     myActiveTaskCount++;
     myTaskCount--;
+    // only the tasks stamped when they were queued are timed
+    std::uint64_t started = 0;
+    if (task->myQueuedAt) {
+      started = now();
+      counters.queueWait.record(started > task->myQueuedAt ? started - task->myQueuedAt : 0);
+    }
     myCurrentTask.reset(task);
-    if (myCurrentTask->status() != NX::AbstractTask::ABORTED) {
+    if (myCurrentTask->status() == NX::AbstractTask::ABORTED) {
+      // nobody is going to run it any more; freeing it also lets go of its hold on the scheduler
+      myCurrentTask.release()->dispose();
+    } else {
       if (myCurrentTask.get() && myCurrentTask->status() == NX::AbstractTask::INACTIVE)
         myCurrentTask->create();
       if (myCurrentTask.get() &&(myCurrentTask->status() == NX::AbstractTask::CREATED ||
-                                 myCurrentTask->status() == NX::AbstractTask::PENDING)) {
+                                 myCurrentTask->status() == NX::AbstractTask::PENDING ||
+                                 myCurrentTask->status() == NX::AbstractTask::SUSPENDED)) {
+        // the slice starts over every time a coroutine gets the thread back
+        myCurrentTask.enter(myTaskSlice && dynamic_cast<NX::CoroutineTask*>(task) ? now() : 0);
         myCurrentTask->enter();
+        myCurrentTask.enter(0);
       }
       if (myCurrentTask.get() && myCurrentTask->status() == NX::AbstractTask::PENDING)
       {
-        myTaskQueue.push(myCurrentTask.release());
-        myTaskCount++;
+        requeueTask(myCurrentTask.release());
+      }
+      else if (myCurrentTask.get() && myCurrentTask->status() == NX::AbstractTask::SUSPENDED)
+      {
+        // nothing queues it until it's resumed, unless that already happened while it was switching away
+        auto * coroutine = static_cast<NX::CoroutineTask*>(myCurrentTask.release());
+        if (!coroutine->park())
+          requeueTask(coroutine);
       }
       else if (auto pTask = myCurrentTask.release()) {
         pTask->exit();
-        delete pTask;
+        // an abort() from another thread may still be running its cancellation handlers
+        pTask->dispose();
       }
     }
     myActiveTaskCount--;
     processed++;
-    if (myPauseTasks) break;
+    if (started)
+      counters.runTime.record(now() - started);
+    Counters::increment(counters.executed);
+    // hand back to the dispatcher now and then, or tasks that keep yielding would starve I/O and timers
+    if (myPauseTasks || processed >= DrainBatch) break;
   }
+  if (processed && !remaining() && !myHoldCount)
+    notifyAll();
   return processed;
 }
 
+bool NX::Scheduler::needThread() const
+{
+  // only grow while there's more queued work than there are parked or starting threads to take it
+  return !myService->stopped() && myPoolSize < myMaxThreads && myTaskCount > myIdleCount + myStartingThreads;
+}
+
 void NX::Scheduler::balanceThreads()
 {
-  while(myTaskCount > 0 && myThreadGroup.size() < myMaxThreads)
+  while(needThread()) {
+    boost::mutex::scoped_lock lock(myThreadsLock);
+    if (!needThread())
+      break;
+    reapThreads();
     addThread();
+  }
+}
+
+void NX::Scheduler::setPlacement(bool affinity, bool numa)
+{
+  BOOST_ASSERT_MSG(myService->stopped(), "thread placement has to be set before the scheduler starts");
+  auto topology = cpuTopology();
+  if (topology.empty())
+    return;
+  // workers are claimed in order as the pool grows, so a small pool fills up one node before spilling onto the next
+  std::vector<std::pair<int, int>> cpus;
+  for(auto & node : topology) {
+    for(int cpu : node.second)
+      cpus.emplace_back(cpu, node.first);
+  }
+  for(std::size_t i = 0; i < myWorkers.size(); i++) {
+    auto & cpu = cpus[i % cpus.size()];
+    if (affinity)
+      myWorkers[i]->place({ cpu.first }, cpu.second);
+    else if (numa)
+      myWorkers[i]->place(topology[cpu.second], cpu.second);
+    else
+      myWorkers[i]->place({}, cpu.second);
+  }
+  myNodeLocal = numa && topology.size() > 1;
+}
+
+void NX::Scheduler::setShardedIO(bool sharded)
+{
+  BOOST_ASSERT_MSG(myService->stopped(), "I/O sharding has to be set before the scheduler starts");
+  myShardedIO = sharded;
+  for(auto & worker : myWorkers) {
+    worker->setService(sharded ? std::make_shared<boost::asio::io_service>(1) : nullptr);
+    if (sharded)
+      worker->service()->stop();
+  }
+  if (sharded)
+    myMinThreads = myMaxThreads;
 }
 
 void NX::Scheduler::start()
@@ -126,6 +634,18 @@ void NX::Scheduler::start()
   BOOST_ASSERT_MSG(myService->stopped(), "call to start with a service already running");
   myService->reset();
   myWork.reset(new boost::asio::io_service::work(*myService));
+  {
+    boost::mutex::scoped_lock lock(myBlockingLock);
+    myBlockingStopped = false;
+  }
+  if (myShardedIO) {
+    for(auto & worker : myWorkers)
+      worker->startService();
+    // every reactor in the pool is handed sockets right away, so all of their threads have to be there for them
+    boost::mutex::scoped_lock lock(myThreadsLock);
+    while (myPoolSize < myMaxThreads)
+      addThread();
+  }
   balanceThreads();
 }
 
@@ -133,21 +653,97 @@ void NX::Scheduler::stop()
 {
   myWork.reset();
   myService->stop();
+  {
+    // jobs still in flight finish, queued ones are dropped along with the rest of the task queues
+    boost::mutex::scoped_lock lock(myBlockingLock);
+    myBlockingStopped = true;
+  }
+  myBlockingCondition.notify_all();
+  if (myShardedIO) {
+    for(auto & worker : myWorkers)
+      worker->stopService();
+  }
 }
 
 void NX::Scheduler::join()
 {
-  myThreadGroup.join_all();
+  while (true) {
+    boost::thread thread;
+    {
+      boost::mutex::scoped_lock lock(myThreadsLock);
+      std::list<boost::thread> & threads = myThreads.empty() ? myRetiredThreads : myThreads;
+      if (threads.empty())
+        break;
+      thread = std::move(threads.front());
+      threads.pop_front();
+    }
+    thread.join();
+  }
+  // nothing is left to hand them work
+  stopBlockingThreads();
 }
 
 NX::AbstractTask * NX::Scheduler::scheduleAbstractTask (NX::AbstractTask * task)
 {
   myTaskCount++;
-  myTaskQueue.push(task);
+  task->myQueuedAt = sampleTime();
+  task->myQueueState.store(NX::AbstractTask::QUEUED, std::memory_order_relaxed);
+  if (Worker * worker = myCurrentWorker.get())
+    worker->push(task);
+  else
+    myInjectionQueues[lane(task)]->push(task);
+  notify();
   balanceThreads();
   return task;
 }
 
+void NX::Scheduler::suspend(const std::function<void(const CompletionHandler &)> & arm)
+{
+  auto * task = dynamic_cast<NX::CoroutineTask*>(myCurrentTask.get());
+  if (!task)
+    throw NX::Exception("call to suspend outside of a coroutine");
+  auto resumed = std::make_shared<std::atomic_bool>(false);
+  arm([task, resumed] {
+    if (!resumed->exchange(true))
+      task->resume();
+  });
+  task->suspend();
+}
+
+void NX::Scheduler::scheduleAbstractTasks(const std::vector<NX::AbstractTask*> & tasks)
+{
+  if (tasks.empty())
+    return;
+  for(auto task : tasks) {
+    task->myQueuedAt = sampleTime();
+    task->myQueueState.store(NX::AbstractTask::QUEUED, std::memory_order_relaxed);
+  }
+  myTaskCount += tasks.size();
+  if (Worker * worker = myCurrentWorker.get())
+    worker->push(tasks.begin(), tasks.end());
+  else {
+    for(auto task : tasks)
+      myInjectionQueues[lane(task)]->push(task);
+  }
+  notify(tasks.size());
+  balanceThreads();
+}
+
+void NX::Scheduler::scheduleBatch(std::vector<CompletionHandler> && handlers, NX::TaskGroup * group)
+{
+  std::vector<NX::AbstractTask*> tasks;
+  tasks.reserve(handlers.size());
+  for(auto & handler : handlers) {
+    auto * task = new NX::Task(std::move(handler), this);
+    // another thread may run and free it as soon as it's queued
+    if (group)
+      group->emplace_back(task);
+    tasks.push_back(task);
+  }
+  handlers.clear();
+  scheduleAbstractTasks(tasks);
+}
+
 void NX::Scheduler::yield()
 {
   if (!myCurrentTask.get()) {
@@ -159,53 +755,173 @@ void NX::Scheduler::yield()
   myCurrentTask->yield();
 }
 
+bool NX::Scheduler::preempt()
+{
+  std::uint64_t entered = myCurrentTask.enteredAt();
+  if (!entered || now() - entered < myTaskSlice)
+    return false;
+  Counters::increment(counters().preemptions);
+  myCurrentTask->yield();
+  return true;
+}
+
 void NX::Scheduler::joinPool(const CompletionHandler & drainTasks) {
   do {
-    dispatcher();
+    dispatcher(drainTasks, false);
     if (drainTasks)
       drainTasks();
-    std::this_thread::sleep_for(std::chrono::microseconds(200));
-  } while (myHoldCount);
+  } while ((myHoldCount || remaining()) && !myService->stopped());
 }
 
-NX::Task *NX::Scheduler::scheduleTask(CompletionHandler &&handler) {
+NX::Task *NX::Scheduler::scheduleTask(CompletionHandler &&handler, Priority priority) {
   if (!handler)
     throw NX::Exception("empty handler provided");
   auto * task = new NX::Task(std::move(handler), this);
+  task->setPriority(priority);
   scheduleAbstractTask(task);
   return task;
 }
 
-NX::Task *NX::Scheduler::scheduleTask(const NX::Scheduler::duration &time, CompletionHandler && handler) {
+NX::Task *NX::Scheduler::scheduleTask(const NX::Scheduler::duration &time, CompletionHandler && handler, Priority priority) {
   if (!handler)
     throw NX::Exception("empty handler provided");
   auto * taskObject = new NX::Task(std::move(handler), this);
-  std::shared_ptr<timer_type> timer(new timer_type(*myService));
-  timer->expires_from_now(time);
-  timer->async_wait(boost::bind(boost::bind(&Scheduler::scheduleAbstractTask, this, taskObject), timer));
-  taskObject->addCancellationHandler([=]() { timer->cancel(); });
+  taskObject->setPriority(priority);
+  addTimer(time, taskObject);
   return taskObject;
 }
 
-NX::CoroutineTask *NX::Scheduler::scheduleCoroutine(CompletionHandler &&handler) {
+NX::CoroutineTask *NX::Scheduler::scheduleCoroutine(CompletionHandler &&handler, Priority priority) {
   if (!handler)
     throw NX::Exception("empty handler provided");
   auto * task = new NX::CoroutineTask(std::move(handler), this);
+  task->setPriority(priority);
   scheduleAbstractTask(task);
   return task;
 }
 
-NX::CoroutineTask *NX::Scheduler::scheduleCoroutine(const NX::Scheduler::duration &time, CompletionHandler &&handler) {
+NX::CoroutineTask *NX::Scheduler::scheduleCoroutine(const NX::Scheduler::duration &time, CompletionHandler &&handler,
+                                                     Priority priority) {
   if (!handler)
     throw NX::Exception("empty handler provided");
   auto * taskObject = new NX::CoroutineTask(std::move(handler), this);
-  std::shared_ptr<timer_type> timer(new timer_type(*myService));
-  timer->expires_from_now(time);
-  timer->async_wait(boost::bind(boost::bind(&Scheduler::scheduleAbstractTask, this, taskObject), timer));
-  taskObject->addCancellationHandler([=]() { timer->cancel(); });
+  taskObject->setPriority(priority);
+  addTimer(time, taskObject);
   return taskObject;
 }
 
+NX::Scheduler::TimerId NX::Scheduler::scheduleTimer(const duration & delay, CompletionHandler && handler, const duration & interval) {
+  if (!handler)
+    throw NX::Exception("empty handler provided");
+  if (interval.total_microseconds() <= 0)
+    return addTimer(delay, new NX::Task(std::move(handler), this));
+  // a periodic timer has no task of its own to keep us alive between runs
+  hold();
+  return addTimer(delay, nullptr, interval, handler);
+}
+
+bool NX::Scheduler::cancelTimer(TimerId id) {
+  NX::AbstractTask * task = nullptr;
+  {
+    boost::mutex::scoped_lock lock(myTimerLock);
+    if (!myTimerWheel.remove(id, &task))
+      return false;
+    myTimersCancelled++;
+  }
+  if (!task) {
+    release();
+    return true;
+  }
+  // the wheel was its only owner. If we're inside its abort() already, that frees it once it's done
+  if (task->status() != NX::AbstractTask::ABORTED)
+    task->abort();
+  task->dispose();
+  return true;
+}
+
+NX::Scheduler::TimerId NX::Scheduler::addTimer(const duration & delay, NX::AbstractTask * task,
+                                               const duration & interval, const CompletionHandler & handler) {
+  std::vector<NX::TimerWheel::Expired> expired;
+  TimerId id = 0;
+  {
+    boost::mutex::scoped_lock lock(myTimerLock);
+    auto now = std::chrono::steady_clock::now();
+    auto expiry = toTick(now + std::chrono::microseconds(std::max<std::int64_t>(delay.total_microseconds(), 0)), true);
+    // catch the wheel up first, so the new timer is placed relative to the present
+    myTimerWheel.advance(toTick(now, false), expired);
+    myTimersFired += expired.size();
+    myTimersScheduled++;
+    if (task) {
+      id = myTimerWheel.add(expiry, task);
+      // still under the lock: the timer can't fire and take the task with it before this is in place
+      task->addCancellationHandler([this, id]() { cancelTimer(id); });
+    } else {
+      auto period = std::max<NX::TimerWheel::Tick>((interval.total_microseconds() + 999) / 1000, 1);
+      id = myTimerWheel.add(expiry, period, handler);
+    }
+    armTimer();
+  }
+  dispatchTimers(expired);
+  return id;
+}
+
+void NX::Scheduler::armTimer() {
+  // only ever move the deadline closer; a wake-up for a timer that was cancelled in the meantime is harmless
+  NX::TimerWheel::Tick next = myTimerWheel.next();
+  if (next >= myTimerArmedAt)
+    return;
+  myTimerArmedAt = next;
+  myTimer->expires_at(myTimerEpoch + std::chrono::milliseconds(next));
+  myTimer->async_wait(boost::bind(&NX::Scheduler::expireTimers, this, boost::asio::placeholders::error));
+  // whoever watches the clock went to sleep with a later deadline in mind
+  if (myShardedIO) {
+    if (Worker * watcher = myTimerWatcher.load())
+      wake(watcher);
+    else
+      notify();
+  }
+}
+
+void NX::Scheduler::expireTimers(const boost::system::error_code & error) {
+  if (error == boost::asio::error::operation_aborted)
+    return;
+  std::vector<NX::TimerWheel::Expired> expired;
+  {
+    boost::mutex::scoped_lock lock(myTimerLock);
+    myTimerArmedAt = NX::TimerWheel::NoTick;
+    myTimerWheel.advance(toTick(std::chrono::steady_clock::now(), false), expired);
+    myTimersFired += expired.size();
+    armTimer();
+  }
+  dispatchTimers(expired);
+}
+
+void NX::Scheduler::dispatchTimers(std::vector<NX::TimerWheel::Expired> & expired) {
+  std::vector<NX::AbstractTask*> tasks;
+  tasks.reserve(expired.size());
+  for(auto & timer : expired)
+    tasks.push_back(timer.task ? timer.task : new NX::Task(std::move(timer.handler), this));
+  scheduleAbstractTasks(tasks);
+}
+
+NX::TimerWheel::Tick NX::Scheduler::toTick(const std::chrono::steady_clock::time_point & time, bool roundUp) const {
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(time - myTimerEpoch).count();
+  if (elapsed < 0)
+    return 0;
+  return NX::TimerWheel::Tick(roundUp ? (elapsed + 999) / 1000 : elapsed / 1000);
+}
+
+void NX::Scheduler::awaitTask(CompletionHandler && handler) {
+  if (!handler)
+    throw NX::Exception("empty handler provided");
+  auto * task = new NX::Task(std::move(handler), this);
+  suspend([this, task](const CompletionHandler & resume) {
+    task->addCompletionHandler(resume);
+    task->addCancellationHandler(resume);
+    scheduleAbstractTask(task);
+  });
+}
+
 bool NX::Scheduler::canYield() const {
   return dynamic_cast<NX::CoroutineTask*>(myCurrentTask.get()) != nullptr;
 }
@@ -218,6 +934,159 @@ NX::Task *NX::Scheduler::scheduleThreadInitTask(NX::Scheduler::CompletionHandler
   return task;
 }
 
+void NX::Scheduler::Strand::schedule(CompletionHandler && handler)
+{
+  if (!handler)
+    throw NX::Exception("empty handler provided");
+  {
+    boost::mutex::scoped_lock lock(myLock);
+    myHandlers.emplace_back(std::move(handler));
+    if (myScheduled)
+      return;
+    myScheduled = true;
+  }
+  auto self = shared_from_this();
+  myScheduler->scheduleTask([self] { self->run(); });
+}
+
+NX::Scheduler::CompletionHandler NX::Scheduler::Strand::wrap(CompletionHandler && handler)
+{
+  auto self = shared_from_this();
+  return [self, handler] { self->schedule(CompletionHandler(handler)); };
+}
+
+void NX::Scheduler::Strand::run()
+{
+  const Strand * previous = Current;
+  Current = this;
+  for(std::size_t i = 0; i < Batch; i++) {
+    CompletionHandler handler;
+    {
+      boost::mutex::scoped_lock lock(myLock);
+      if (myHandlers.empty()) {
+        myScheduled = false;
+        Current = previous;
+        return;
+      }
+      handler = std::move(myHandlers.front());
+      myHandlers.pop_front();
+    }
+    handler();
+  }
+  Current = previous;
+  // still busy: go back through the queue rather than hog the thread; it lands on this thread's own deque
+  auto self = shared_from_this();
+  myScheduler->scheduleTask([self] { self->run(); });
+}
+
+void NX::Scheduler::scheduleBlocking(CompletionHandler && work, CompletionHandler && then, Priority priority)
+{
+  if (!work)
+    throw NX::Exception("empty handler provided");
+  hold();
+  boost::mutex::scoped_lock lock(myBlockingLock);
+  myBlockingQueue.push_back({ std::move(work), std::move(then), priority, now() });
+  // a thread is only added when none is waiting; the pool never shrinks, blocking threads are cheap to keep parked
+  if (myBlockingIdle || myBlockingThreads.size() >= myBlockingMaxThreads) {
+    lock.unlock();
+    myBlockingCondition.notify_one();
+    return;
+  }
+  myBlockingThreads.emplace_back(boost::bind(&NX::Scheduler::blockingDispatcher, this));
+}
+
+void NX::Scheduler::blockingDispatcher()
+{
+  boost::mutex::scoped_lock lock(myBlockingLock);
+  while (true) {
+    myBlockingIdle++;
+    while (myBlockingQueue.empty() && !myBlockingStopped)
+      myBlockingCondition.wait(lock);
+    myBlockingIdle--;
+    if (myBlockingStopped)
+      break;
+    BlockingJob job = std::move(myBlockingQueue.front());
+    myBlockingQueue.pop_front();
+    std::uint64_t started = now();
+    myBlockingQueueWait.record(started - job.queuedAt);
+    lock.unlock();
+    job.work();
+    if (job.then)
+      scheduleTask(std::move(job.then), job.priority);
+    std::uint64_t finished = now();
+    job = BlockingJob();
+    release();
+    lock.lock();
+    myBlockingExecuted++;
+    myBlockingRunTime.record(finished - started);
+  }
+}
+
+void NX::Scheduler::stopBlockingThreads()
+{
+  std::list<boost::thread> threads;
+  {
+    boost::mutex::scoped_lock lock(myBlockingLock);
+    myBlockingStopped = true;
+    threads.swap(myBlockingThreads);
+  }
+  myBlockingCondition.notify_all();
+  for(auto & thread : threads)
+    thread.join();
+  // whatever never got to run is dropped, along with the holds it took
+  std::deque<BlockingJob> jobs;
+  {
+    boost::mutex::scoped_lock lock(myBlockingLock);
+    jobs.swap(myBlockingQueue);
+  }
+  for(std::size_t i = 0; i < jobs.size(); i++)
+    release();
+}
+
+void NX::Scheduler::parallelFor(std::size_t begin, std::size_t end, std::size_t grain, RangeHandler && body,
+                                JoinHandler && then, Priority priority)
+{
+  if (!body || !then)
+    throw NX::Exception("empty handler provided");
+  if (end <= begin) {
+    scheduleTask(std::bind(std::move(then), std::exception_ptr()), priority);
+    return;
+  }
+  if (!grain)
+    grain = grainFor(end - begin);
+  struct Join {
+    RangeHandler body;
+    JoinHandler then;
+    std::atomic_size_t remaining;
+    std::atomic_flag failed;
+    std::exception_ptr error;
+  };
+  auto join = std::make_shared<Join>();
+  join->body = std::move(body);
+  join->then = std::move(then);
+  join->remaining = (end - begin + grain - 1) / grain;
+  join->failed.clear();
+  std::vector<NX::AbstractTask*> tasks;
+  tasks.reserve(join->remaining);
+  for(std::size_t from = begin; from < end; from += std::min(grain, end - from)) {
+    std::size_t to = from + std::min(grain, end - from);
+    auto * task = new NX::Task([join, from, to]() {
+      try {
+        join->body(from, to);
+      } catch(...) {
+        if (!join->failed.test_and_set())
+          join->error = std::current_exception();
+      }
+      // the decrement publishes our error (if any) to whoever finishes last
+      if (join->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        join->then(join->error);
+    }, this);
+    task->setPriority(priority);
+    tasks.push_back(task);
+  }
+  scheduleAbstractTasks(tasks);
+}
+
 NX::Scheduler::Holder::Holder() : myScheduler(nullptr) {}
 
 NX::Scheduler::Holder::Holder(NX::Scheduler *scheduler) : myScheduler(scheduler) {
@@ -0,0 +1,143 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "nexus.h"
+#include "stack_pool.h"
+
+#include <boost/context/stack_traits.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace {
+  // stacks that don't fit in a thread's cache wait here for another thread before being unmapped
+  constexpr std::size_t SharedDepth = 256;
+
+  std::size_t poolStackSize = boost::context::stack_traits::default_size();
+  std::size_t poolThreadDepth = 64;
+
+  std::atomic_size_t stackHits(0), stackMisses(0);
+
+  boost::mutex sharedLock;
+  std::vector<void*> sharedStacks;
+
+  // the full size of a mapping, guard page included
+  std::size_t mappingSize() {
+    return poolStackSize + boost::context::stack_traits::page_size();
+  }
+
+  void * mapStack() {
+    void * base = ::mmap(nullptr, mappingSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+      throw std::bad_alloc();
+    // stacks grow downwards, so the guard goes at the bottom
+    ::mprotect(base, boost::context::stack_traits::page_size(), PROT_NONE);
+    return base;
+  }
+
+  void unmapStack(void * base) {
+    ::munmap(base, mappingSize());
+  }
+
+  struct ThreadStacks {
+    std::vector<void*> stacks;
+    ~ThreadStacks();
+  };
+
+  // coroutines can still finish during thread teardown, after the cache itself is gone
+  thread_local bool threadStacksDestroyed = false;
+  thread_local ThreadStacks threadStacks;
+
+  ThreadStacks::~ThreadStacks() {
+    threadStacksDestroyed = true;
+    for(auto base : stacks)
+      unmapStack(base);
+  }
+}
+
+void NX::StackPool::configure(std::size_t size, std::size_t depth)
+{
+  std::size_t page = boost::context::stack_traits::page_size();
+  size = std::max(size, boost::context::stack_traits::minimum_size());
+  if (!boost::context::stack_traits::is_unbounded())
+    size = std::min(size, boost::context::stack_traits::maximum_size());
+  poolStackSize = (size + page - 1) / page * page;
+  poolThreadDepth = depth;
+}
+
+boost::context::stack_context NX::StackPool::allocate()
+{
+  void * base = nullptr;
+  if (!threadStacksDestroyed && !threadStacks.stacks.empty()) {
+    base = threadStacks.stacks.back();
+    threadStacks.stacks.pop_back();
+  } else {
+    boost::mutex::scoped_lock lock(sharedLock);
+    if (!sharedStacks.empty()) {
+      base = sharedStacks.back();
+      sharedStacks.pop_back();
+    }
+  }
+  if (base) {
+    stackHits.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    stackMisses.fetch_add(1, std::memory_order_relaxed);
+    base = mapStack();
+  }
+  boost::context::stack_context stack;
+  stack.size = mappingSize();
+  stack.sp = static_cast<char*>(base) + stack.size;
+  return stack;
+}
+
+void NX::StackPool::deallocate(boost::context::stack_context & stack)
+{
+  void * base = static_cast<char*>(stack.sp) - stack.size;
+  if (!threadStacksDestroyed && threadStacks.stacks.size() < poolThreadDepth) {
+    threadStacks.stacks.push_back(base);
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(sharedLock);
+    if (sharedStacks.size() < SharedDepth) {
+      sharedStacks.push_back(base);
+      return;
+    }
+  }
+  unmapStack(base);
+}
+
+std::size_t NX::StackPool::stackSize()
+{
+  return poolStackSize;
+}
+
+std::size_t NX::StackPool::hits()
+{
+  return stackHits;
+}
+
+std::size_t NX::StackPool::misses()
+{
+  return stackMisses;
+}
@@ -21,12 +21,131 @@
 #include "task.h"
 #include "scheduler.h"
 #include "exception.h"
+#include "stack_pool.h"
 
 #include <iostream>
 
-NX::CoroutineTask::CoroutineTask (NX::Scheduler::CompletionHandler && handler, NX::Scheduler * scheduler, bool hold):
-  AbstractTask(scheduler, hold), myHandler(std::move(handler)), myScheduler(scheduler), myCoroutine(), myPullCa(nullptr), myStatus(INACTIVE)
+namespace {
+  constexpr std::size_t PoolGranularity = 64;
+  constexpr std::size_t PoolClasses = 8;
+  // blocks of each size class a single thread may hold on to, and how many it trades with the depot at once
+  constexpr std::size_t PoolDepth = 1024;
+  constexpr std::size_t PoolBatch = 256;
+  constexpr std::size_t DepotDepth = 64;
+
+  struct PoolBlock {
+    PoolBlock * next;
+  };
+
+  /**
+   * Tasks tend to be created on one thread and freed on another, so a thread's own free list alone would
+   * leave producers always allocating and consumers always hoarding. Full batches go through a shared depot instead.
+   */
+  struct PoolDepot {
+    boost::mutex lock;
+    std::vector<PoolBlock*> batches[PoolClasses];
+  };
+
+  struct ThreadPool {
+    PoolBlock * blocks[PoolClasses] = {};
+    std::size_t counts[PoolClasses] = {};
+    ~ThreadPool();
+  };
+
+  PoolDepot poolDepot;
+
+  // tasks can still be freed during thread teardown, after the pool itself is gone
+  thread_local bool threadPoolDestroyed = false;
+  thread_local ThreadPool threadPool;
+
+  std::atomic_size_t poolTaskAllocations(0), poolHandlerAllocations(0);
+
+  void freeChain(PoolBlock * block) {
+    while (block) {
+      PoolBlock * next = block->next;
+      WTF::fastFree(block);
+      block = next;
+    }
+  }
+
+  ThreadPool::~ThreadPool() {
+    threadPoolDestroyed = true;
+    for(auto & block : blocks)
+      freeChain(block);
+  }
+}
+
+void * NX::TaskPool::allocate(std::size_t size)
+{
+  std::size_t index = (size - 1) / PoolGranularity;
+  if (index < PoolClasses && !threadPoolDestroyed) {
+    ThreadPool & pool = threadPool;
+    if (!pool.blocks[index]) {
+      boost::mutex::scoped_lock lock(poolDepot.lock);
+      auto & batches = poolDepot.batches[index];
+      if (!batches.empty()) {
+        pool.blocks[index] = batches.back();
+        pool.counts[index] = PoolBatch;
+        batches.pop_back();
+      }
+    }
+    if (PoolBlock * block = pool.blocks[index]) {
+      pool.blocks[index] = block->next;
+      pool.counts[index]--;
+      return block;
+    }
+  }
+  // a whole block even during thread teardown: it may be freed on a live thread and pooled for a bigger task
+  if (index < PoolClasses)
+    size = (index + 1) * PoolGranularity;
+  poolTaskAllocations.fetch_add(1, std::memory_order_relaxed);
+  return WTF::fastMalloc(size);
+}
+
+void NX::TaskPool::deallocate(void * ptr, std::size_t size)
+{
+  std::size_t index = (size - 1) / PoolGranularity;
+  if (index >= PoolClasses || threadPoolDestroyed) {
+    WTF::fastFree(ptr);
+    return;
+  }
+  ThreadPool & pool = threadPool;
+  auto * block = static_cast<PoolBlock*>(ptr);
+  block->next = pool.blocks[index];
+  pool.blocks[index] = block;
+  if (++pool.counts[index] < PoolDepth)
+    return;
+  // split a batch off the top of the list and hand it over
+  PoolBlock * batch = pool.blocks[index], * last = batch;
+  for(std::size_t i = 1; i < PoolBatch; i++)
+    last = last->next;
+  pool.blocks[index] = last->next;
+  pool.counts[index] -= PoolBatch;
+  last->next = nullptr;
+  {
+    boost::mutex::scoped_lock lock(poolDepot.lock);
+    auto & batches = poolDepot.batches[index];
+    if (batches.size() < DepotDepth) {
+      batches.push_back(batch);
+      return;
+    }
+  }
+  freeChain(batch);
+}
+
+std::size_t NX::TaskPool::taskAllocations()
+{
+  return poolTaskAllocations;
+}
+
+std::size_t NX::TaskPool::handlerAllocations()
 {
+  return poolHandlerAllocations;
+}
+
+void NX::TaskPool::countHandlerAllocation()
+{
+  poolHandlerAllocations.fetch_add(1, std::memory_order_relaxed);
 }
 
 void NX::CoroutineTask::create()
@@ -34,7 +153,8 @@ void NX::CoroutineTask::create()
   if (myStatus == ABORTED) return;
   myStatus.store(CREATED);
   myScheduler->makeCurrent(this);
-  myCoroutine.reset(new NX::CoroutineTask::push_type(boost::bind(&NX::CoroutineTask::coroutine, this, _1)));
+  myCoroutine.reset(new NX::CoroutineTask::push_type(NX::StackPool::Allocator(),
+                                                     boost::bind(&NX::CoroutineTask::coroutine, this, _1)));
 }
 
 void NX::CoroutineTask::enter()
@@ -55,6 +175,65 @@ void NX::CoroutineTask::yield()
   myStatus.store(ACTIVE);
 }
 
+void NX::CoroutineTask::suspend()
+{
+  if (myStatus == ABORTED)
+    throw NX::Exception("task aborted, could not suspend");
+  // resumed before we even got here: nothing to wait for
+  int state = WOKEN;
+  if (myWakeState.compare_exchange_strong(state, RUNNING))
+    return;
+  myStatus.store(SUSPENDED);
+  myPullCa->operator()();
+  myScheduler->makeCurrent(this);
+  myStatus.store(ACTIVE);
+}
+
+void NX::CoroutineTask::resume()
+{
+  int state = myWakeState.load();
+  while (true) {
+    if (state == PARKED) {
+      if (myWakeState.compare_exchange_weak(state, RUNNING)) {
+        // it may run and be freed as soon as it's queued
+        NX::Scheduler * scheduler = myScheduler;
+        scheduler->scheduleAbstractTask(this);
+        scheduler->release();
+        return;
+      }
+    } else if (state == RUNNING) {
+      if (myWakeState.compare_exchange_weak(state, WOKEN))
+        return;
+    } else {
+      return;
+    }
+  }
+}
+
+bool NX::CoroutineTask::park()
+{
+  // a parked coroutine has nothing queued on its behalf, so it holds the scheduler to keep it from winding down
+  NX::Scheduler * scheduler = myScheduler;
+  scheduler->hold();
+  int state = RUNNING;
+  if (myWakeState.compare_exchange_strong(state, PARKED))
+    return true;
+  myWakeState.store(RUNNING);
+  scheduler->release();
+  return false;
+}
+
+void NX::CoroutineTask::discard()
+{
+  myCancellationHandlers.clear();
+  myCompletionHandlers.clear();
+  // once it has run, its body is live on the coroutine's stack and goes when the stack is unwound
+  if (myPullCa)
+    return;
+  myCoroutine.reset();
+  myHandler.reset();
+}
+
 void NX::CoroutineTask::coroutine (NX::CoroutineTask::pull_type & ca)
 {
   if (myStatus == ABORTED) return;
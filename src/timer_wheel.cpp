@@ -0,0 +1,218 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "nexus.h"
+#include "timer_wheel.h"
+#include "exception.h"
+
+#include <algorithm>
+
+constexpr NX::TimerWheel::Tick NX::TimerWheel::NoTick;
+
+NX::TimerWheel::TimerWheel(Tick now): myTimers(), myFreeList(), mySlots(), myOccupied(), myCurrent(now), mySize(0)
+{
+  std::fill(std::begin(mySlots), std::end(mySlots), None);
+}
+
+NX::TimerWheel::Id NX::TimerWheel::add(Tick expiry, NX::AbstractTask * task)
+{
+  return insert(expiry, 0, task, Handler());
+}
+
+NX::TimerWheel::Id NX::TimerWheel::add(Tick expiry, Tick period, const Handler & handler)
+{
+  if (!period)
+    throw NX::Exception("periodic timer with a zero period");
+  return insert(expiry, period, nullptr, handler);
+}
+
+NX::TimerWheel::Id NX::TimerWheel::insert(Tick expiry, Tick period, NX::AbstractTask * task, const Handler & handler)
+{
+  std::uint32_t index = allocate();
+  Timer & timer = myTimers[index];
+  // anything already due fires on the next tick
+  timer.expiry = std::max(expiry, myCurrent + 1);
+  timer.period = period;
+  timer.task = task;
+  timer.handler = handler;
+  link(index);
+  mySize++;
+  return (Id(timer.generation) << IndexBits) | index;
+}
+
+bool NX::TimerWheel::remove(Id id, NX::AbstractTask ** task)
+{
+  Timer * timer = find(id);
+  if (!timer)
+    return false;
+  std::uint32_t index = std::uint32_t(id & ((Id(1) << IndexBits) - 1));
+  if (task)
+    *task = timer->task;
+  unlink(index);
+  release(index);
+  return true;
+}
+
+bool NX::TimerWheel::contains(Id id) const
+{
+  return const_cast<TimerWheel*>(this)->find(id) != nullptr;
+}
+
+NX::TimerWheel::Timer * NX::TimerWheel::find(Id id)
+{
+  std::uint32_t index = std::uint32_t(id & ((Id(1) << IndexBits) - 1));
+  if (index >= myTimers.size())
+    return nullptr;
+  Timer & timer = myTimers[index];
+  if (timer.slot == None || timer.generation != (id >> IndexBits))
+    return nullptr;
+  return &timer;
+}
+
+void NX::TimerWheel::advance(Tick now, std::vector<Expired> & expired)
+{
+  while (mySize) {
+    Tick tick = next();
+    if (tick > now)
+      break;
+    myCurrent = tick;
+    // cascade the upper levels first: what they hand down may be due on this very tick
+    for(unsigned level = LevelCount - 1; level > 0; level--) {
+      unsigned shift = level * SlotBits;
+      if (tick & ((Tick(1) << shift) - 1))
+        continue;
+      std::uint32_t index = detachSlot(level * SlotCount + ((tick >> shift) & (SlotCount - 1)));
+      while (index != None) {
+        std::uint32_t following = myTimers[index].next;
+        link(index);
+        index = following;
+      }
+    }
+    std::uint32_t index = detachSlot(std::uint32_t(tick & (SlotCount - 1)));
+    while (index != None) {
+      Timer & timer = myTimers[index];
+      std::uint32_t following = timer.next;
+      if (timer.period) {
+        expired.push_back({ nullptr, timer.handler });
+        // step from the deadline, not from now, and skip whole periods if we fell behind
+        timer.expiry += timer.period;
+        if (timer.expiry <= now)
+          timer.expiry += ((now - timer.expiry) / timer.period + 1) * timer.period;
+        link(index);
+      } else {
+        expired.push_back({ timer.task, Handler() });
+        release(index);
+      }
+      index = following;
+    }
+  }
+  if (now > myCurrent)
+    myCurrent = now;
+}
+
+NX::TimerWheel::Tick NX::TimerWheel::next() const
+{
+  Tick result = NoTick;
+  for(unsigned level = 0; level < LevelCount; level++) {
+    std::uint64_t occupied = myOccupied[level];
+    if (!occupied)
+      continue;
+    unsigned shift = level * SlotBits;
+    Tick base = myCurrent >> shift;
+    // slots are searched starting right after the current one; the current slot itself comes up last
+    unsigned start = unsigned((base + 1) & (SlotCount - 1));
+    std::uint64_t rotated = start ? (occupied >> start) | (occupied << (SlotCount - start)) : occupied;
+    Tick tick = (base + 1 + __builtin_ctzll(rotated)) << shift;
+    result = std::min(result, tick);
+  }
+  return result;
+}
+
+std::uint32_t NX::TimerWheel::allocate()
+{
+  if (!myFreeList.empty()) {
+    std::uint32_t index = myFreeList.back();
+    myFreeList.pop_back();
+    return index;
+  }
+  if (myTimers.size() >= (std::size_t(1) << IndexBits))
+    throw NX::Exception("too many active timers");
+  myTimers.push_back(Timer { 0, 0, nullptr, Handler(), 1, None, None, None });
+  return std::uint32_t(myTimers.size() - 1);
+}
+
+void NX::TimerWheel::release(std::uint32_t index)
+{
+  Timer & timer = myTimers[index];
+  timer.task = nullptr;
+  timer.handler = nullptr;
+  timer.slot = None;
+  // bump the generation so that stale ids stop matching; zero is skipped so no id is ever 0
+  timer.generation = (timer.generation + 1) & ((std::uint32_t(1) << GenerationBits) - 1);
+  if (!timer.generation)
+    timer.generation = 1;
+  myFreeList.push_back(index);
+  mySize--;
+}
+
+void NX::TimerWheel::link(std::uint32_t index)
+{
+  Timer & timer = myTimers[index];
+  Tick expiry = std::max(timer.expiry, myCurrent);
+  Tick delta = expiry - myCurrent;
+  unsigned level = 0;
+  while (level < LevelCount - 1 && delta >> (SlotBits * (level + 1)))
+    level++;
+  // beyond the top level's span: park it at the far edge, it will be cascaded again from there
+  if (delta >> (SlotBits * LevelCount))
+    expiry = myCurrent + (Tick(1) << (SlotBits * LevelCount)) - 1;
+  unsigned position = unsigned((expiry >> (SlotBits * level)) & (SlotCount - 1));
+  std::uint32_t slot = level * SlotCount + position;
+  timer.slot = slot;
+  timer.prev = None;
+  timer.next = mySlots[slot];
+  if (timer.next != None)
+    myTimers[timer.next].prev = index;
+  mySlots[slot] = index;
+  myOccupied[level] |= std::uint64_t(1) << position;
+}
+
+void NX::TimerWheel::unlink(std::uint32_t index)
+{
+  Timer & timer = myTimers[index];
+  if (timer.prev != None)
+    myTimers[timer.prev].next = timer.next;
+  else
+    mySlots[timer.slot] = timer.next;
+  if (timer.next != None)
+    myTimers[timer.next].prev = timer.prev;
+  if (mySlots[timer.slot] == None)
+    myOccupied[timer.slot / SlotCount] &= ~(std::uint64_t(1) << (timer.slot % SlotCount));
+  timer.slot = timer.prev = timer.next = None;
+}
+
+std::uint32_t NX::TimerWheel::detachSlot(std::uint32_t slot)
+{
+  std::uint32_t head = mySlots[slot];
+  mySlots[slot] = None;
+  myOccupied[slot / SlotCount] &= ~(std::uint64_t(1) << (slot % SlotCount));
+  for(std::uint32_t index = head; index != None; index = myTimers[index].next)
+    myTimers[index].slot = None;
+  return head;
+}
@@ -0,0 +1,87 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Aborts queued tasks from a thread outside the pool while the pool is busy, so that every abort() races either
+ * a worker popping the task or a worker finishing it. A victim that got picked up before its abort() waits for its
+ * first cancellation handler and then returns, so its worker frees it while the rest of the handlers still run.
+ * Catches a task freed from under its abort() as a crash, or reliably when built with -fsanitize=address.
+ */
+
+#include "nexus.h"
+#include "task.h"
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+namespace {
+  const int victims = 20000;
+  const int fillers = 64;
+}
+
+int main() {
+  NX::Scheduler scheduler(nullptr, std::max(boost::thread::hardware_concurrency(), 2u));
+  std::unique_ptr<std::atomic_bool[]> reached(new std::atomic_bool[victims]);
+  std::atomic_int ran(0), cancelled(0), misread(0);
+  std::atomic_bool done(false);
+  std::vector<NX::AbstractTask*> tasks;
+  for(int i = 0; i < victims; i++) {
+    reached[i].store(false);
+    auto * task = new NX::Task([&, i] {
+      while (!reached[i])
+        boost::this_thread::yield();
+      ran++;
+    }, &scheduler);
+    task->addCancellationHandler([&, i] { reached[i].store(true); });
+    task->addCancellationHandler([&, task] {
+      // still ours to look at, however far the worker got with it
+      for(int j = 0; j < 64; j++) {
+        if (task->status() == NX::AbstractTask::INACTIVE)
+          misread++;
+      }
+      cancelled++;
+    });
+    tasks.push_back(task);
+  }
+  // keeps every worker busy popping and pushing while the victims are aborted
+  std::function<void()> fill = [&] {
+    if (!done)
+      scheduler.scheduleTask(NX::Scheduler::CompletionHandler(fill));
+  };
+  for(int i = 0; i < fillers; i++)
+    scheduler.scheduleTask(NX::Scheduler::CompletionHandler(fill));
+  scheduler.scheduleAbstractTasks(tasks);
+  scheduler.start();
+  boost::thread aborter([&] {
+    for(auto * task : tasks)
+      task->abort();
+    done.store(true);
+  });
+  scheduler.joinPool([] {});
+  scheduler.join();
+  aborter.join();
+  if (cancelled != victims || misread || scheduler.queued()) {
+    std::cerr << cancelled << " of " << victims << " cancelled, " << misread << " misread, "
+              << scheduler.queued() << " left queued" << std::endl;
+    return 1;
+  }
+  std::cout << victims << " aborted, " << ran << " of them while running" << std::endl;
+  return 0;
+}
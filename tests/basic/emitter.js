@@ -17,6 +17,11 @@ async function start() {
   console.log('second test done!');
   const values = await test.emit('returns-a-value', 10);
   console.log('third test done, returned values are:'); console.inspect(values);
+  // names nobody listens to are looked up, not added to the event table
+  test.off(`never-${Date.now()}`, () => {});
+  const none = await test.emit(`unheard-${Date.now()}`, 1);
+  if (!Array.isArray(none) || none.length)
+    throw new Error('emitting an event without listeners must resolve to an empty array');
 }
 
 start().catch(console.error);
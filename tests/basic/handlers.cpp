@@ -0,0 +1,69 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Races add() on a task's handler list against the list running, the way await() races the task it waits on
+ * finishing. Every handler has to run exactly once, whichever side gets there first.
+ */
+
+#include "nexus.h"
+#include "task.h"
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+namespace {
+  const int rounds = 100000;
+}
+
+int main() {
+  std::unique_ptr<NX::TaskHandlerList> list;
+  std::atomic_int started(-1), finished(-1), calls(0), lost(0), repeated(0);
+  boost::thread runner([&] {
+    for(int i = 0; i < rounds; i++) {
+      while (started < i)
+        boost::this_thread::yield();
+      (*list)();
+      finished.store(i);
+    }
+  });
+  for(int i = 0; i < rounds; i++) {
+    list.reset(new NX::TaskHandlerList());
+    calls.store(0);
+    // the runner is spinning on this; staggering add() a little lets either side get there first
+    started.store(i);
+    for(int j = 0; j < i % 3; j++)
+      boost::this_thread::yield();
+    list->add([&] { calls++; });
+    while (finished < i)
+      boost::this_thread::yield();
+    if (calls == 0)
+      lost++;
+    else if (calls > 1)
+      repeated++;
+  }
+  runner.join();
+  if (lost || repeated) {
+    std::cerr << lost << " handlers lost, " << repeated << " run more than once in " << rounds << " rounds" << std::endl;
+    return 1;
+  }
+  std::cout << rounds << " handlers run once each" << std::endl;
+  return 0;
+}
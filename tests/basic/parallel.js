@@ -0,0 +1,44 @@
+const scheduler = Nexus.Scheduler;
+
+function expect(condition, message) {
+  if (!condition)
+    throw new Error(message);
+}
+
+(async () => {
+  const seen = new Uint8Array(10000);
+  await scheduler.parallelFor(seen.length, (begin, end) => {
+    for (let i = begin; i < end; i++)
+      seen[i]++;
+  }, { grain: 64 });
+  expect(seen.every(count => count === 1), 'parallelFor must visit every index exactly once');
+
+  const numbers = new Float64Array(100000).map((_, i) => (i * 7919) % 100003);
+  const doubled = await scheduler.parallelMap(numbers, value => value * 2);
+  expect(doubled instanceof Float64Array && doubled.length === numbers.length, 'parallelMap must keep the array type');
+  expect(doubled.every((value, i) => value === numbers[i] * 2), 'parallelMap returned a wrong element');
+
+  const sum = numbers.reduce((a, b) => a + b, 0);
+  expect(await scheduler.parallelReduce(numbers, 'sum') === sum, 'native sum is off');
+  expect(await scheduler.parallelReduce(numbers, (a, b) => a + b) === sum, 'scripted sum is off');
+  expect(await scheduler.parallelReduce(numbers, 'min') === numbers.reduce((a, b) => Math.min(a, b)),
+    'native min is off');
+  expect(await scheduler.parallelReduce(numbers, 'max', { initial: 1e9 }) === 1e9, 'initial must take part in max');
+  expect(await scheduler.parallelReduce(new Int32Array(0), 'sum') === 0, 'the sum of nothing is 0');
+
+  const sorted = await scheduler.parallelSort(new Float64Array([3, NaN, -1, 2, 10, 0]), { grain: 2 });
+  expect(sorted.slice(0, 5).join() === '-1,0,2,3,10' && isNaN(sorted[5]), 'parallelSort got the order wrong');
+
+  let rejected = false;
+  await scheduler.parallelFor([0, 100], begin => {
+    if (begin >= 50)
+      throw new RangeError('chunk failed');
+  }, { grain: 10 }).catch(e => rejected = e instanceof RangeError);
+  expect(rejected, 'a throwing chunk must reject the promise with its own error');
+
+  for (const range of [Infinity, [0, Infinity], 2 ** 64, [0, Number.MAX_SAFE_INTEGER + 2]]) {
+    let ran = false, invalid = false;
+    await scheduler.parallelFor(range, () => ran = true).catch(() => invalid = true);
+    expect(invalid && !ran, `parallelFor must reject the range ${range}`);
+  }
+})();
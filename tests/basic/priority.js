@@ -0,0 +1,32 @@
+// with more threads, idle ones steal bulk work while it's still being queued, so only a single thread is predictable
+if (Nexus.Scheduler.concurrency !== 1)
+  throw new Error('run this test with --concurrency 1');
+
+const order = [];
+
+// queued from one task, so they all wait in the same thread's queue behind each other
+Nexus.Scheduler.schedule(() => {
+  for (let i = 0; i < 100; i++)
+    Nexus.Scheduler.schedule(() => order.push('background'), { priority: 'background' });
+  for (let i = 0; i < 100; i++)
+    Nexus.Scheduler.schedule(() => order.push('default'));
+  for (let i = 0; i < 10; i++)
+    Nexus.Scheduler.schedule(() => order.push('interactive'), { priority: 'interactive' });
+});
+
+let threw = false;
+try {
+  Nexus.Scheduler.schedule(() => {}, { priority: 'urgent' });
+} catch (e) {
+  threw = true;
+}
+if (!threw)
+  throw new Error('an unknown priority was accepted');
+
+setTimeout(() => {
+  if (order.length !== 210)
+    throw new Error(`expected 210 tasks to have run, got ${order.length}`);
+  // a few lower priority tasks are let through ahead, so they don't starve
+  if (order.lastIndexOf('interactive') > 12)
+    throw new Error(`interactive work was held up: ${order.slice(0, 20)}`);
+}, 100);
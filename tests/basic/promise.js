@@ -55,6 +55,23 @@
     console.log(reason);
   });
 }
+{
+  const p = new Promise(resolve => Nexus.Scheduler.schedule(() => resolve(p)));
+  p.catch(e => console.log(e instanceof TypeError)); // true
+}
+{
+  new Promise(resolve => resolve(Promise.resolve('adopted'))).then(v => console.log(v)); // adopted
+  Promise.reject('passed down').then(v => console.log(v)).catch(e => console.log(e)); // passed down
+}
+{
+  const thenable = { then(resolve) { resolve('thenable'); } };
+  Promise.all([thenable, 1, Promise.resolve(2)]).then(values => {
+    if (values[0] !== 'thenable' || values[1] !== 1 || values[2] !== 2)
+      throw new Error(`Promise.all did not adopt a thenable: ${values}`);
+    console.log(values); // ["thenable", 1, 2]
+  });
+  Promise.all([{ then(resolve, reject) { reject('thenable rejected'); } }]).catch(e => console.log(e)); // thenable rejected
+}
 {
   const p1 = Promise.reject("test unhandled rejection").then(v => console.log(v));
 }
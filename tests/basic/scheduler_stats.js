@@ -0,0 +1,19 @@
+const before = Nexus.Scheduler.stats();
+const executed = stats => stats.executed.reduce((a, b) => a + b, 0);
+
+for (let i = 0; i < 1000; i++)
+  Nexus.Scheduler.schedule(() => {});
+
+setTimeout(() => {
+  const stats = Nexus.Scheduler.stats();
+  if (executed(stats) - executed(before) < 1000)
+    throw new Error(`expected at least 1000 more tasks to have run, got ${executed(stats) - executed(before)}`);
+  if (stats.timers.fired < 1 || stats.timers.scheduled < 1)
+    throw new Error('timer counts were not updated');
+  for (const name of ['queueWait', 'runTime']) {
+    const histogram = stats[name];
+    if (!histogram.count || histogram.p50 > histogram.p99 || histogram.p99 > histogram.max)
+      throw new Error(`inconsistent ${name} histogram: ${JSON.stringify(histogram)}`);
+  }
+  console.log(JSON.stringify(stats));
+}, 50);
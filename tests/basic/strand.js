@@ -0,0 +1,22 @@
+const strand = Nexus.Scheduler.strand();
+const order = [];
+let running = false;
+
+for (let i = 0; i < 1000; i++) {
+  strand.schedule(() => {
+    if (running)
+      throw new Error('two handlers of one strand ran at the same time');
+    running = true;
+    order.push(i);
+    running = false;
+  });
+}
+
+setTimeout(() => {
+  if (order.length !== 1000)
+    throw new Error(`expected 1000 handlers to have run, got ${order.length}`);
+  order.forEach((value, index) => {
+    if (value !== index)
+      throw new Error(`handler ${value} ran in position ${index}`);
+  });
+}, 100);
@@ -0,0 +1,24 @@
+const start = Date.now();
+let ticks = 0;
+
+const cancelled = setTimeout(() => { throw new Error('cleared timeout fired'); }, 10);
+clearTimeout(cancelled);
+clearTimeout(cancelled);
+
+const interval = setInterval(() => {
+  if (++ticks === 5) {
+    clearInterval(interval);
+    const elapsed = Date.now() - start;
+    if (elapsed < 100)
+      throw new Error(`interval fired early: 5 ticks in ${elapsed}ms`);
+    console.log(`5 interval ticks in ${elapsed}ms`);
+  }
+}, 20);
+
+setTimeout((a, b) => {
+  if (a + b !== 3)
+    throw new Error('timeout arguments were not passed through');
+  if (ticks !== 5)
+    throw new Error(`expected 5 interval ticks, got ${ticks}`);
+  console.log('timers done!');
+}, 250, 1, 2);
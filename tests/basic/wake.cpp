@@ -0,0 +1,79 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Has a busy worker queue a task that only a second, parked worker can run, since the busy one sits on a task that
+ * waits for it. The wake-up goes through the shared reactor, where the busy worker's own poll_one() passes by first;
+ * if it takes the wake-up for itself, the parked one sleeps through its whole idle timeout.
+ */
+
+#include "nexus.h"
+#include "task.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+namespace {
+  const int rounds = 20;
+  const auto idleTimeout = boost::posix_time::seconds(5);
+  const auto patience = std::chrono::seconds(1);
+}
+
+int main() {
+  NX::Scheduler scheduler(nullptr, 2, 2, idleTimeout);
+  std::atomic_int late(0), arrived(0);
+  scheduler.hold();
+  scheduler.start();
+  // gets both pool threads going
+  for(int i = 0; i < 2; i++) {
+    scheduler.scheduleTask([&] {
+      arrived++;
+      while (arrived < 2)
+        boost::this_thread::yield();
+    });
+  }
+  for(int round = 0; round < rounds; round++) {
+    // long enough for both workers to park
+    boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    std::atomic_bool done(false), ran(false);
+    scheduler.scheduleTask([&] {
+      scheduler.scheduleTask([&] { ran.store(true); });
+      // popped first by the same worker, which then waits on the other one
+      scheduler.scheduleTask([&] {
+        auto start = std::chrono::steady_clock::now();
+        while (!ran)
+          boost::this_thread::yield();
+        if (std::chrono::steady_clock::now() - start > patience)
+          late++;
+        done.store(true);
+      });
+    });
+    while (!done)
+      boost::this_thread::yield();
+  }
+  scheduler.release();
+  scheduler.join();
+  if (late) {
+    std::cerr << late << " of " << rounds << " wake-ups went to a busy worker" << std::endl;
+    return 1;
+  }
+  std::cout << rounds << " wake-ups reached a parked worker" << std::endl;
+  return 0;
+}
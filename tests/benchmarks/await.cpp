@@ -0,0 +1,73 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Parks coroutines on a timer for a fixed time, once by spinning on yield() and once through suspend(),
+ * and reports how many times the scheduler re-entered them while they waited.
+ *
+ * Built on demand: `make benchmark_await && ./src/benchmark_await`
+ */
+
+#include "nexus.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+namespace {
+  const int waiters = 1000;
+  const auto wait = boost::posix_time::milliseconds(200);
+
+  void run(const char * name, bool spin) {
+    NX::Scheduler scheduler(nullptr, boost::thread::hardware_concurrency());
+    std::atomic_int finished(0);
+    for(int i = 0; i < waiters; i++) {
+      scheduler.scheduleCoroutine([&] {
+        if (spin) {
+          std::atomic_bool fired(false);
+          scheduler.scheduleTimer(wait, [&] { fired.store(true); });
+          while (!fired)
+            scheduler.yield();
+        } else {
+          scheduler.suspend([&](const NX::Scheduler::CompletionHandler & resume) {
+            scheduler.scheduleTimer(wait, NX::Scheduler::CompletionHandler(resume));
+          });
+        }
+        finished++;
+      });
+    }
+    auto start = std::chrono::steady_clock::now();
+    scheduler.start();
+    scheduler.joinPool([] {});
+    scheduler.join();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    auto stats = scheduler.stats();
+    std::uint64_t executed = 0;
+    for(auto count : stats.executed)
+      executed += count;
+    std::cout << name << ": " << finished << " waiters done in " << elapsed.count() << "ms, "
+              << stats.yields << " re-entries while waiting, " << executed << " task runs" << std::endl;
+  }
+}
+
+int main() {
+  run("yield", true);
+  run("suspend", false);
+  return 0;
+}
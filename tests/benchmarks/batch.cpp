@@ -0,0 +1,65 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Fans out rounds of small tasks from a single task, once one scheduleTask() at a time and once through
+ * scheduleBatch(), and reports how long the pool took to get through all of them.
+ *
+ * Built on demand: `make benchmark_batch && ./src/benchmark_batch`
+ */
+
+#include "nexus.h"
+#include "task.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+namespace {
+  const int rounds = 10000;
+  const int width = 100;
+
+  void run(const char * name, bool batched) {
+    NX::Scheduler scheduler(nullptr, boost::thread::hardware_concurrency());
+    std::atomic_size_t executed(0);
+    NX::Scheduler::CompletionHandler work = [&] { executed++; };
+    scheduler.scheduleTask(NX::Scheduler::CompletionHandler([&] {
+      for(int round = 0; round < rounds; round++) {
+        if (batched) {
+          scheduler.scheduleBatch(std::vector<NX::Scheduler::CompletionHandler>(width, work));
+        } else {
+          for(int i = 0; i < width; i++)
+            scheduler.scheduleTask(NX::Scheduler::CompletionHandler(work));
+        }
+      }
+    }));
+    auto start = std::chrono::steady_clock::now();
+    scheduler.start();
+    scheduler.joinPool([] {});
+    scheduler.join();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << name << ": " << executed << " tasks in " << elapsed.count() << "ms" << std::endl;
+  }
+}
+
+int main() {
+  run("one at a time", false);
+  run("batched", true);
+  return 0;
+}
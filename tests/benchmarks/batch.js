@@ -0,0 +1,27 @@
+// Fans out the same number of tasks with one schedule() call each and with a single scheduleAll(),
+// and reports the throughput of both.
+const total = 200000, width = 100;
+
+function run(mode, next) {
+  const start = Date.now();
+  const fns = [];
+  let remaining = total;
+  const done = () => {
+    if (--remaining)
+      return;
+    const elapsed = Date.now() - start;
+    console.log(`${mode}: ${total} tasks in ${elapsed}ms (${Math.round(total / elapsed)} tasks/ms)`);
+    if (next)
+      Nexus.Scheduler.schedule(next);
+  };
+  for(let i = 0; i < width; i++)
+    fns.push(done);
+  for(let i = 0; i < total / width; i++) {
+    if (mode === 'scheduleAll')
+      Nexus.Scheduler.scheduleAll(fns);
+    else
+      fns.forEach(fn => Nexus.Scheduler.schedule(fn));
+  }
+}
+
+Nexus.Scheduler.schedule(() => run('schedule', () => run('scheduleAll')));
@@ -0,0 +1,111 @@
+/*
+ * Nexus.js - The next-gen JavaScript platform
+ * Copyright (C) 2016  Abdullah A. Hassan <abdullah@webtomizer.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Registers the same native listener on an EventEmitter twice, once wrapped in a bound JavaScript function the way
+ * it used to be and once as a native callback, and reports the cost of an emitFast() dispatch for both.
+ *
+ * Built on demand: `make benchmark_emitter && ./src/benchmark_emitter`
+ */
+
+#include "nexus.h"
+#include "context.h"
+#include "classes/emitter.h"
+#include "scoped_string.h"
+#include "util.h"
+
+#include <JavaScriptCore/runtime/InitializeThreading.h>
+
+#include <chrono>
+#include <iostream>
+
+namespace {
+  const int dispatches = 1000000;
+
+  const JSClassDefinition CallbackClass {
+    0, kJSClassAttributeNone, "EventCallback", nullptr, nullptr, nullptr, nullptr, [](JSObjectRef object) {
+      delete reinterpret_cast<NX::Classes::Emitter::EventCallback*>(JSObjectGetPrivate(object));
+    }
+  };
+
+  // just enough of the runtime for an emitter to work with: options, a scheduler and a context
+  class Runtime: public NX::Nexus {
+  public:
+    Runtime(int argc, const char ** argv): NX::Nexus(argc, argv) {
+      parseArguments();
+      initScheduler();
+      myMainContext = NX::Context::create(this);
+    }
+  };
+
+  template<typename Dispatch>
+  void run(const char * name, Dispatch && dispatch) {
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < dispatches; i++)
+      dispatch();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << name << ": " << dispatches << " dispatches in " << elapsed.count() / 1000000 << "ms, "
+              << elapsed.count() / dispatches << "ns each" << std::endl;
+  }
+}
+
+int main(int argc, const char ** argv) {
+  WTF::initializeMainThread();
+  WTF::initializeThreading();
+  JSC::initializeThreading();
+  // the options want a script to run; nothing is run, so the benchmark itself will do
+  const char * arguments[] { argv[0], argv[0] };
+  Runtime runtime(2, arguments);
+  NX::Context * context = runtime.mainContext();
+  JSGlobalContextRef ctx = context->toJSContext();
+  auto * emitter = new NX::Classes::Emitter();
+  JSObjectRef thisObject = JSObjectMake(ctx, NX::Classes::Emitter::createClass(context),
+                                        dynamic_cast<NX::Classes::Base*>(emitter));
+  JSValueProtect(ctx, thisObject);
+  std::size_t calls = 0;
+  NX::Classes::Emitter::EventCallback callback = [&](JSContextRef ctx, std::size_t, const JSValueRef[], JSValueRef *) {
+    calls++;
+    return JSValueMakeUndefined(ctx);
+  };
+  JSValueRef args[] { JSValueMakeNumber(ctx, 42) };
+  // the old way: the callback hidden behind a bound function, which the emitter calls like any script listener
+  JSClassRef callbackClass = JSClassCreate(&CallbackClass);
+  JSObjectRef holder = JSObjectMake(ctx, callbackClass, new NX::Classes::Emitter::EventCallback(callback));
+  JSObjectRef function = NX::JSBindFunction(ctx, JSObjectMakeFunctionWithCallback(ctx, NX::ScopedString("callback"),
+    [](JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount,
+       const JSValueRef arguments[], JSValueRef* exception) -> JSValueRef {
+      auto callback = reinterpret_cast<NX::Classes::Emitter::EventCallback*>(JSObjectGetPrivate(thisObject));
+      return (*callback)(ctx, argumentCount, arguments, exception);
+    }), holder, 0, nullptr, nullptr);
+  emitter->addListener(ctx, thisObject, "bound", function);
+  emitter->addListener(ctx, thisObject, "native", callback);
+  const NX::Classes::Emitter::EventId bound = NX::Classes::Emitter::intern("bound");
+  const NX::Classes::Emitter::EventId native = NX::Classes::Emitter::intern("native");
+  run("bound function", [&] {
+    JSValueRef exception = nullptr;
+    emitter->emitFast(ctx, thisObject, bound, 1, args, &exception);
+  });
+  run("native slot", [&] {
+    JSValueRef exception = nullptr;
+    emitter->emitFast(ctx, thisObject, native, 1, args, &exception);
+  });
+  JSValueUnprotect(ctx, thisObject);
+  JSClassRelease(callbackClass);
+  return calls == 2 * dispatches ? 0 : 1;
+}
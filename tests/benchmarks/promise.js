@@ -0,0 +1,40 @@
+// Measures promise creation and settlement, long then() chains and Promise.all() over many promises,
+// and reports the throughput of each.
+const total = 100000, depth = 1000;
+
+function report(name, count, start) {
+  const elapsed = Math.max(Date.now() - start, 1);
+  console.log(`${name}: ${count} in ${elapsed}ms (${Math.round(count / elapsed)}/ms)`);
+}
+
+function create() {
+  const start = Date.now();
+  let remaining = total;
+  return new Promise(resolve => {
+    for(let i = 0; i < total; i++)
+      new Promise(resolve => resolve(i)).then(() => {
+        if (!--remaining) {
+          report('create and resolve', total, start);
+          resolve();
+        }
+      });
+  });
+}
+
+function chain() {
+  const start = Date.now();
+  let promise = Promise.resolve(0);
+  for(let i = 0; i < depth; i++)
+    promise = promise.then(v => v + 1);
+  return promise.then(() => report('then() chain', depth, start));
+}
+
+function all() {
+  const start = Date.now();
+  const promises = [];
+  for(let i = 0; i < total; i++)
+    promises.push(Promise.resolve(i));
+  return Promise.all(promises).then(values => report('Promise.all', values.length, start));
+}
+
+create().then(chain).then(all);
@@ -0,0 +1,33 @@
+// Emits the same chunks through emit() and through the promise-free emitInline() that streams use
+// internally, then reads a file through a ReadableStream, and reports the throughput of each along with
+// how many of the stream's read buffers came from the pool.
+const chunks = 100000, fileSize = 64 * 1024 * 1024;
+
+async function emitter(mode) {
+  const emitter = new Nexus.EventEmitter(), chunk = new ArrayBuffer(1024);
+  let bytes = 0;
+  emitter.on('data', buffer => { bytes += buffer.byteLength; });
+  const start = Date.now();
+  for(let i = 0; i < chunks; i++)
+    await emitter[mode]('data', chunk);
+  const elapsed = Date.now() - start;
+  console.log(`${mode}: ${chunks} chunks in ${elapsed}ms (${Math.round(chunks / elapsed)} chunks/ms)`);
+}
+
+async function stream() {
+  // left in the build tree for the benchmark_stream_cleanup test to remove
+  const sink = new Nexus.IO.FileSinkDevice('stream-benchmark.tmp');
+  sink.writeSync(new ArrayBuffer(fileSize));
+  await sink.close();
+  const stream = new Nexus.IO.ReadableStream(new Nexus.IO.FilePushDevice('stream-benchmark.tmp'));
+  let bytes = 0;
+  stream.on('data', buffer => { bytes += buffer.byteLength; });
+  const before = Nexus.Scheduler.allocations, start = Date.now();
+  await stream.resume();
+  const elapsed = Date.now() - start, after = Nexus.Scheduler.allocations;
+  await stream.close();
+  console.log(`stream: ${bytes} bytes in ${elapsed}ms (${Math.round(bytes / 1024 / elapsed)} KiB/ms)`);
+  console.log(`read buffers: ${after.buffers - before.buffers} allocated, ${after.buffersReused - before.buffersReused} reused`);
+}
+
+emitter('emit').then(() => emitter('emitInline')).then(stream).catch(console.error);
@@ -0,0 +1,28 @@
+// Schedules tasks from inside tasks, the way promises and event emitters do, and reports how many
+// heap allocations the scheduler needed for each of them.
+const rounds = 10, perRound = 20000;
+let remaining = rounds * perRound;
+let before, start;
+
+function done() {
+  if (--remaining)
+    return;
+  const elapsed = Date.now() - start;
+  const after = Nexus.Scheduler.allocations;
+  const total = rounds * perRound;
+  console.log(`${total} tasks in ${elapsed}ms (${Math.round(total / elapsed)} tasks/ms)`);
+  console.log(`task allocations per task: ${((after.tasks - before.tasks) / total).toFixed(4)}`);
+  console.log(`handler allocations per task: ${((after.handlers - before.handlers) / total).toFixed(4)}`);
+}
+
+function round() {
+  for(let i = 0; i < perRound; i++)
+    Nexus.Scheduler.schedule(done);
+}
+
+Nexus.Scheduler.schedule(() => {
+  before = Nexus.Scheduler.allocations;
+  start = Date.now();
+  for(let i = 0; i < rounds; i++)
+    Nexus.Scheduler.schedule(round);
+});